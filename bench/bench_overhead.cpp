@@ -0,0 +1,198 @@
+// Benchmarks for mettle's own overhead: building suites, running tests, logging
+// their results, and checking expectations. Run these with `make bench`. To
+// catch regressions, save a baseline with `--bench-save` and check later runs
+// against it with `--bench-baseline`.
+
+#include <mettle.hpp>
+using namespace mettle;
+
+#include <functional>
+#include <streambuf>
+
+// A suite of `count` empty tests, split into subsuites of 1000 tests each so
+// that it's shaped a bit more like a real test binary.
+runnable_suite synthetic_suite(size_t count) {
+  return make_suite<>("synthetic", [count](auto &_) {
+    for(size_t i = 0; i < count; i += 1000) {
+      subsuite<>(_, "subsuite " + std::to_string(i / 1000),
+                 [i, count](auto &_) {
+        for(size_t j = i; j != std::min(count, i + 1000); j++)
+          _.test("test " + std::to_string(j), []() {});
+      });
+    }
+  });
+}
+
+struct synthetic_tests {
+  std::vector<runnable_suite> suites;
+};
+
+struct null_logger : test_logger {
+  void start_run() {}
+  void end_run() {}
+
+  void start_suite(const std::vector<std::string> &) {}
+  void end_suite(const std::vector<std::string> &) {}
+
+  void start_test(const test_name &) {}
+  void passed_test(const test_name &, const test_metrics &) {}
+  void skipped_test(const test_name &) {}
+  void failed_test(const test_name &, const std::string &,
+                   const test_metrics &) {}
+  void timed_out_test(const test_name &, std::chrono::milliseconds) {}
+};
+
+// Throws away everything written to it, but only after it's been formatted.
+struct null_buffer : std::streambuf {
+  int overflow(int c) {
+    return c;
+  }
+};
+
+// The biggest suites take a second or more per iteration, so just take a few
+// samples of them.
+bench_options options_for(size_t count) {
+  bench_options options;
+  if(count >= 100000)
+    options.samples = 3;
+  return options;
+}
+
+const size_t sizes[] = {1000, 10000, 100000, 1000000};
+
+suite<> bench_startup("startup", [](auto &_) {
+  for(auto count : sizes) {
+    _.bench("build " + std::to_string(count) + " tests", [count]() {
+      auto built = synthetic_suite(count);
+    }, options_for(count));
+  }
+});
+
+suite<synthetic_tests> bench_runner("runner", [](auto &_) {
+  for(auto count : sizes) {
+    subsuite<>(_, std::to_string(count) + " tests", [count](auto &_) {
+      _.setup([count](synthetic_tests &f) {
+        f.suites.push_back(synthetic_suite(count));
+      });
+
+      _.bench("inline", [](synthetic_tests &f) {
+        run_tests(f.suites, null_logger{}, false);
+      }, options_for(count));
+    });
+  }
+
+  // Forking is much slower than anything else here, so only try it with the
+  // smallest suite.
+  subsuite<>(_, "1000 forked tests", [](auto &_) {
+    _.setup([](synthetic_tests &f) {
+      f.suites.push_back(synthetic_suite(1000));
+    });
+
+    bench_options options;
+    options.samples = 3;
+
+    _.bench("fork per test", [](synthetic_tests &f) {
+      run_tests(f.suites, null_logger{});
+    }, options);
+
+    _.bench("fork per test, 4 jobs", [](synthetic_tests &f) {
+      run_tests(f.suites, null_logger{}, true, 4);
+    }, options);
+
+    _.bench("worker pool", [](synthetic_tests &f) {
+      null_logger logger;
+      run_options run;
+      run.worker_pool = true;
+      run_tests(f.suites, logger, run);
+    }, options);
+  });
+});
+
+suite<> bench_loggers("loggers", [](auto &_) {
+  for(unsigned int verbosity = 0; verbosity != 3; verbosity++) {
+    _.bench("log 1000 tests at verbosity " + std::to_string(verbosity),
+            [verbosity]() {
+      null_buffer buf;
+      std::ostream out(&buf);
+      detail::verbose_logger vlog(out, verbosity);
+      detail::single_run_logger logger(vlog);
+
+      test_metrics metrics;
+      logger.start_run();
+      logger.start_suite({"suite"});
+      for(size_t i = 0; i != 1000; i++) {
+        test_name name = {{"suite"}, "test " + std::to_string(i), i};
+        logger.start_test(name);
+        logger.passed_test(name, metrics);
+      }
+      logger.end_suite({"suite"});
+      logger.end_run();
+    });
+  }
+});
+
+suite<> bench_matchers("matchers", [](auto &_) {
+  _.bench("passing expect()", []() {
+    expect(42, equal_to(42));
+  });
+
+  _.bench("failing expect()", []() {
+    try {
+      expect(42, equal_to(43));
+    }
+    catch(const expectation_error &) {}
+  });
+
+  _.bench("combined matchers", []() {
+    expect(42, all(greater(0), less(100), any(40, 41, 42)));
+  });
+
+  _.bench("each() over 1000 elements", []() {
+    static const std::vector<int> data(1000, 1);
+    expect(data, each(greater(0)));
+  });
+
+  _.bench("each() over 1000000 floats", []() {
+    static const std::vector<float> data(1000000, 1.0f);
+    expect(data, each(less(2.0f)));
+  });
+
+  _.bench("elements_near_to() over 1000000 floats", []() {
+    static const std::vector<float> data(1000000, 1.0f);
+    expect(data, elements_near_to(std::ref(data), 1e-6f));
+  });
+
+  _.bench("diff a failing equal_to() over 1000000 ints", []() {
+    static const std::vector<int> expected(1000000, 1);
+    static const auto actual = [] {
+      auto v = expected;
+      v[500000] = 2;
+      return v;
+    }();
+    try {
+      expect(actual, equal_to(expected));
+    }
+    catch(const expectation_error &) {}
+  });
+
+  _.bench("failing expect_each() over 1000000 floats", []() {
+    static const std::vector<float> data = [] {
+      std::vector<float> v(1000000, 1.0f);
+      for(size_t i = 0; i < v.size(); i += 1000)
+        v[i] = 3.0f;
+      return v;
+    }();
+    try {
+      expect_each(data, less(2.0f));
+    }
+    catch(const expectation_error &) {}
+  });
+
+  _.bench("describe a failing each()", []() {
+    static const std::vector<int> data(1000, 1);
+    try {
+      expect(data, each(greater(1)));
+    }
+    catch(const expectation_error &) {}
+  });
+});
@@ -0,0 +1,115 @@
+#ifndef INC_METTLE_ALLOCATION_HOOKS_HPP
+#define INC_METTLE_ALLOCATION_HOOKS_HPP
+
+// Replaces the global operator new and operator delete with versions that
+// count every allocation, so that each test's metrics show how much its body
+// allocated and how much of that it left behind. Since this *defines* the
+// replacements, include it in exactly one source file of a test binary (the
+// same one as the driver is a good choice).
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "suite.hpp"
+
+namespace mettle {
+
+namespace detail {
+  // Each block is prefixed with its size, so that we know how much is freed
+  // without relying on sized deallocation. The prefix is padded out to keep
+  // the block suitably aligned.
+  constexpr size_t allocation_prefix = alignof(std::max_align_t);
+
+  inline void * counted_malloc(size_t size) noexcept {
+    auto block = static_cast<char *>(std::malloc(allocation_prefix + size));
+    if(!block)
+      return nullptr;
+    std::memcpy(block, &size, sizeof(size));
+
+    auto &counts = allocation_counts();
+    counts.count.fetch_add(1, std::memory_order_relaxed);
+    counts.bytes.fetch_add(size, std::memory_order_relaxed);
+    return block + allocation_prefix;
+  }
+
+  inline void counted_free(void *ptr) noexcept {
+    if(!ptr)
+      return;
+    auto block = static_cast<char *>(ptr) - allocation_prefix;
+    size_t size;
+    std::memcpy(&size, block, sizeof(size));
+
+    auto &counts = allocation_counts();
+    counts.frees.fetch_add(1, std::memory_order_relaxed);
+    counts.freed_bytes.fetch_add(size, std::memory_order_relaxed);
+    std::free(block);
+  }
+
+  inline void * counted_new(size_t size) {
+    if(size == 0)
+      size = 1;
+    void *ptr;
+    while(!(ptr = counted_malloc(size))) {
+      auto handler = std::get_new_handler();
+      if(!handler)
+        throw std::bad_alloc();
+      handler();
+    }
+    return ptr;
+  }
+
+  inline void * counted_new(size_t size, const std::nothrow_t &) noexcept {
+    try {
+      return counted_new(size);
+    }
+    catch(...) {
+      return nullptr;
+    }
+  }
+}
+
+} // namespace mettle
+
+void * operator new(std::size_t size) {
+  return mettle::detail::counted_new(size);
+}
+
+void * operator new[](std::size_t size) {
+  return mettle::detail::counted_new(size);
+}
+
+void * operator new(std::size_t size, const std::nothrow_t &t) noexcept {
+  return mettle::detail::counted_new(size, t);
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t &t) noexcept {
+  return mettle::detail::counted_new(size, t);
+}
+
+void operator delete(void *ptr) noexcept {
+  mettle::detail::counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  mettle::detail::counted_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  mettle::detail::counted_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  mettle::detail::counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  mettle::detail::counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+  mettle::detail::counted_free(ptr);
+}
+
+#endif
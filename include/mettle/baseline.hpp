@@ -0,0 +1,311 @@
+#ifndef INC_METTLE_BASELINE_HPP
+#define INC_METTLE_BASELINE_HPP
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "loggers.hpp"
+#include "results.hpp"
+#include "runner.hpp"
+
+namespace mettle {
+
+namespace detail {
+  // The one-sided 95% critical value of Student's t-distribution with `dof`
+  // degrees of freedom. This uses the Cornish-Fisher expansion around the
+  // normal quantile, which is within a couple percent for dof >= 2 (and errs
+  // on the side of calling things significant below that).
+  inline double t_critical(double dof) {
+    const double z = 1.6448536269514722;
+    const double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z;
+    double v = std::max(dof, 1.0);
+    return z + (z3 + z) / (4 * v) +
+           (5 * z5 + 16 * z3 + 3 * z) / (96 * v * v) +
+           (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * v * v * v);
+  }
+
+  // Welch's t-test on two sets of benchmark samples: is `latest` slower than
+  // `base` by more than we'd expect from noise? With fewer than two samples on
+  // either side, there's no way to tell, so we assume it is.
+  inline bool significantly_slower(const bench_stats &base,
+                                   const bench_stats &latest) {
+    if(base.samples < 2 || latest.samples < 2)
+      return true;
+
+    auto variance = [](const bench_stats &s) {
+      double sd = s.stddev.count();
+      return sd * sd / s.samples;
+    };
+    double v0 = variance(base), v1 = variance(latest);
+    double diff = latest.mean.count() - base.mean.count();
+    if(v0 + v1 == 0)
+      return diff > 0;
+
+    double t = diff / std::sqrt(v0 + v1);
+    double dof = (v0 + v1) * (v0 + v1) / (
+      v0 * v0 / (base.samples - 1) + v1 * v1 / (latest.samples - 1)
+    );
+    return t > t_critical(dof);
+  }
+}
+
+// A saved set of benchmark results to compare later runs against. It's stored
+// as text so that it can be checked in or passed between machines. Each line
+// is a record of tab-separated fields, escaped as in a results file:
+//
+//   bench     SAMPLES  ITERATIONS  MEAN-NS  MEDIAN-NS  STDDEV-NS  MIN-NS  MAX-NS
+//             SUITE...  TEST
+//   counters  CYCLES  INSTRUCTIONS  BRANCH-MISSES  L1D-MISSES  LLC-MISSES
+//             SUITE...  TEST
+//
+// A `counters` line holds the hardware counts per iteration for the bench
+// line with the same name; it's only written if any were available, and an
+// unavailable count is written as -1.
+class bench_baseline {
+public:
+  size_t size() const {
+    return benches_.size();
+  }
+
+  bool find(const test_name &test, bench_stats &stats) const {
+    auto i = benches_.find(key(test));
+    if(i == benches_.end())
+      return false;
+    stats = i->second;
+    return true;
+  }
+
+  void record(const test_name &test, const bench_stats &stats) {
+    benches_[key(test)] = stats;
+  }
+
+  // Returns false if any line couldn't be understood; the rest are still read.
+  bool read(std::istream &in) {
+    bool ok = true;
+    for(std::string line; std::getline(in, line);) {
+      if(!line.empty() && !read_line(line))
+        ok = false;
+    }
+    return ok;
+  }
+
+  void write(std::ostream &out) const {
+    using detail::escape_field;
+    auto old_precision = out.precision(17);
+    for(const auto &i : benches_) {
+      const auto &s = i.second;
+      out << "bench\t" << s.samples << "\t" << s.iterations << "\t"
+          << s.mean.count() << "\t" << s.median.count() << "\t"
+          << s.stddev.count() << "\t" << s.min.count() << "\t"
+          << s.max.count();
+      write_name(out, i.first);
+
+      if(s.counters.available()) {
+        out << "counters";
+        for(auto field : detail::counter_fields)
+          out << "\t" << s.counters.*field;
+        write_name(out, i.first);
+      }
+    }
+    out.precision(old_precision);
+  }
+
+  bool load(const std::string &path) {
+    std::ifstream in(path);
+    return in && read(in);
+  }
+
+  bool save(const std::string &path) const {
+    std::ofstream out(path);
+    write(out);
+    return out.flush().good();
+  }
+private:
+  using key_type = std::vector<std::string>;
+
+  static key_type key(const test_name &test) {
+    key_type k = test.suites;
+    k.push_back(test.test);
+    return k;
+  }
+
+  static void write_name(std::ostream &out, const key_type &name) {
+    for(const auto &i : name)
+      out << "\t" << detail::escape_field(i);
+    out << "\n";
+  }
+
+  bool read_line(const std::string &line) {
+    auto fields = detail::split_fields(line);
+    auto number = [](const std::string &s) {
+      return std::strtod(s.c_str(), nullptr);
+    };
+
+    if(fields[0] == "counters") {
+      const size_t n = std::extent<decltype(detail::counter_fields)>::value;
+      // The bench line always comes first, so it should already be here.
+      auto i = fields.size() >= n + 3 ?
+        benches_.find(key_type(fields.begin() + n + 1, fields.end())) :
+        benches_.end();
+      if(i == benches_.end())
+        return false;
+      for(size_t j = 0; j != n; j++)
+        i->second.counters.*detail::counter_fields[j] = number(fields[j + 1]);
+      return true;
+    }
+
+    if(fields[0] != "bench" || fields.size() < 10)
+      return false;
+    using duration = bench_stats::duration;
+    bench_stats s;
+    s.samples = std::strtoul(fields[1].c_str(), nullptr, 10);
+    s.iterations = std::strtoul(fields[2].c_str(), nullptr, 10);
+    s.mean = duration(number(fields[3]));
+    s.median = duration(number(fields[4]));
+    s.stddev = duration(number(fields[5]));
+    s.min = duration(number(fields[6]));
+    s.max = duration(number(fields[7]));
+
+    benches_[key_type(fields.begin() + 8, fields.end())] = s;
+    return true;
+  }
+
+  std::map<key_type, bench_stats> benches_;
+};
+
+// Records every benchmark that passes into a baseline, e.g. to save as the
+// baseline for later runs.
+class baseline_logger : public test_logger {
+public:
+  baseline_logger(bench_baseline &baseline) : baseline_(baseline) {}
+
+  void start_run() {}
+  void end_run() {}
+
+  void start_suite(const std::vector<std::string> &) {}
+  void end_suite(const std::vector<std::string> &) {}
+
+  void start_test(const test_name &) {}
+  void passed_test(const test_name &, const test_metrics &) {}
+  void skipped_test(const test_name &) {}
+  void failed_test(const test_name &, const std::string &,
+                   const test_metrics &) {}
+  void timed_out_test(const test_name &, std::chrono::milliseconds) {}
+
+  void passed_bench(const test_name &test, const bench_stats &stats,
+                    const test_metrics &) {
+    baseline_.record(test, stats);
+  }
+private:
+  bench_baseline &baseline_;
+};
+
+// Passes everything on to another logger, except that a benchmark that's
+// slower than its baseline is reported as a failure. To count as slower, its
+// mean has to be more than `threshold` (as a fraction) above the baseline's,
+// *and* the difference has to be statistically significant, so that a noisy
+// benchmark doesn't fail at random.
+class baseline_checker : public test_logger {
+public:
+  baseline_checker(test_logger &logger, const bench_baseline &baseline,
+                   double threshold = 0.1)
+    : logger_(logger), baseline_(baseline), threshold_(threshold) {}
+
+  void start_run() {
+    logger_.start_run();
+  }
+  void end_run() {
+    logger_.end_run();
+  }
+
+  void start_suite(const std::vector<std::string> &suites) {
+    logger_.start_suite(suites);
+  }
+  void end_suite(const std::vector<std::string> &suites) {
+    logger_.end_suite(suites);
+  }
+
+  void start_test(const test_name &test) {
+    logger_.start_test(test);
+  }
+  void passed_test(const test_name &test, const test_metrics &metrics) {
+    logger_.passed_test(test, metrics);
+  }
+  void skipped_test(const test_name &test) {
+    logger_.skipped_test(test);
+  }
+  void failed_test(const test_name &test, const std::string &message,
+                   const test_metrics &metrics) {
+    logger_.failed_test(test, message, metrics);
+  }
+  void timed_out_test(const test_name &test,
+                      std::chrono::milliseconds elapsed) {
+    logger_.timed_out_test(test, elapsed);
+  }
+
+  void passed_bench(const test_name &test, const bench_stats &stats,
+                    const test_metrics &metrics) {
+    bench_stats base;
+    if(!baseline_.find(test, base))
+      logger_.passed_bench(test, stats, metrics);
+    else if(slower(base, stats))
+      logger_.failed_test(test, time_message(base, stats), metrics);
+    else if(more_instructions(base, stats))
+      logger_.failed_test(test, instructions_message(base, stats), metrics);
+    else
+      logger_.passed_bench(test, stats, metrics);
+  }
+private:
+  bool slower(const bench_stats &base, const bench_stats &latest) const {
+    return latest.mean > base.mean * (1 + threshold_) &&
+           detail::significantly_slower(base, latest);
+  }
+
+  // Instruction counts hardly vary from run to run, so there's no need for a
+  // significance test here.
+  bool more_instructions(const bench_stats &base,
+                         const bench_stats &latest) const {
+    double before = base.counters.instructions,
+           after = latest.counters.instructions;
+    return before > 0 && after >= 0 && after > before * (1 + threshold_);
+  }
+
+  static std::string time_message(const bench_stats &base,
+                                  const bench_stats &latest) {
+    using detail::format_duration;
+    std::stringstream s;
+    s << "regressed from " << format_duration(base.mean) << " to "
+      << format_duration(latest.mean) << " per iteration (+" << std::fixed
+      << std::setprecision(1)
+      << (latest.mean / base.mean - 1) * 100 << "%)";
+    return s.str();
+  }
+
+  static std::string instructions_message(const bench_stats &base,
+                                          const bench_stats &latest) {
+    double before = base.counters.instructions,
+           after = latest.counters.instructions;
+    std::stringstream s;
+    s << std::fixed << std::setprecision(1) << "regressed from " << before
+      << " to " << after << " instructions per iteration (+"
+      << (after / before - 1) * 100 << "%)";
+    return s.str();
+  }
+
+  test_logger &logger_;
+  const bench_baseline &baseline_;
+  double threshold_;
+};
+
+} // namespace mettle
+
+#endif
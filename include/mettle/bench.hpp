@@ -0,0 +1,185 @@
+#ifndef INC_METTLE_BENCH_HPP
+#define INC_METTLE_BENCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "counters.hpp"
+
+namespace mettle {
+
+// How long a benchmark runs for. After warming up, the benchmark takes
+// `samples` timings, each of a batch of iterations sized so that all the
+// samples together take about `target` long.
+struct bench_options {
+  std::chrono::milliseconds target = std::chrono::milliseconds(100);
+  std::chrono::milliseconds warmup = std::chrono::milliseconds(10);
+  size_t samples = 10;
+};
+
+// The time a single iteration of a benchmark took, summarized over all the
+// samples.
+struct bench_stats {
+  using duration = std::chrono::duration<double, std::nano>;
+
+  size_t samples = 0;
+  size_t iterations = 0; // Per sample.
+  duration mean{}, median{}, stddev{}, min{}, max{};
+  // The mean of each hardware counter per iteration, if they're being
+  // counted.
+  hw_counters counters;
+};
+
+namespace detail {
+  struct bench_timer {
+    bool paused = false;
+    std::chrono::steady_clock::time_point paused_at;
+    std::chrono::steady_clock::duration paused_for{};
+  };
+
+  inline bench_timer & current_bench_timer() {
+    static bench_timer timer;
+    return timer;
+  }
+
+  // The stats of the last benchmark to finish, for the test wrapper to pick
+  // up.
+  inline bench_stats & current_bench_stats() {
+    static bench_stats stats;
+    return stats;
+  }
+}
+
+// Stop counting time (and hardware counters) towards the current benchmark,
+// e.g. while preparing the input for the next iteration. Outside of a
+// benchmark, this does nothing useful.
+inline void pause_timing() {
+  auto &timer = detail::current_bench_timer();
+  if(!timer.paused) {
+    timer.paused = true;
+    timer.paused_at = std::chrono::steady_clock::now();
+    if(auto *counters = detail::active_counters())
+      counters->enable(false);
+  }
+}
+
+inline void resume_timing() {
+  auto &timer = detail::current_bench_timer();
+  if(timer.paused) {
+    if(auto *counters = detail::active_counters())
+      counters->enable(true);
+    timer.paused_for += std::chrono::steady_clock::now() - timer.paused_at;
+    timer.paused = false;
+  }
+}
+
+namespace detail {
+  inline bench_stats summarize_samples(std::vector<double> samples,
+                                       size_t iterations) {
+    using duration = bench_stats::duration;
+    bench_stats stats;
+    stats.samples = samples.size();
+    stats.iterations = iterations;
+    if(samples.empty())
+      return stats;
+
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    double sum = 0;
+    for(auto i : samples)
+      sum += i;
+    double mean = sum / n;
+
+    double squares = 0;
+    for(auto i : samples)
+      squares += (i - mean) * (i - mean);
+
+    stats.mean = duration(mean);
+    stats.median = duration(n % 2 ? samples[n / 2] :
+                            (samples[n / 2 - 1] + samples[n / 2]) / 2);
+    stats.stddev = duration(n > 1 ? std::sqrt(squares / (n - 1)) : 0);
+    stats.min = duration(samples.front());
+    stats.max = duration(samples.back());
+    return stats;
+  }
+
+  inline void per_iteration(hw_counters &counters, size_t iterations) {
+    for(auto field : counter_fields) {
+      if(counters.*field >= 0)
+        counters.*field /= iterations;
+    }
+  }
+
+  // Time `body` as described by `options`. Each sample is the mean time of
+  // one iteration in its batch, leaving out any time spent paused.
+  template<typename F>
+  bench_stats run_bench(const bench_options &options, F &&body) {
+    using namespace std::chrono;
+    using clock = steady_clock;
+
+    // Benchmarks can run other benchmarks (mettle's own tests do, at least),
+    // so restore the outer benchmark's timer when we're done.
+    struct restore_timer {
+      ~restore_timer() { current_bench_timer() = outer; }
+      bench_timer outer;
+    } restore = { current_bench_timer() };
+
+    auto &timer = current_bench_timer();
+    // The wall time of the last batch, including any time spent paused.
+    nanoseconds wall{};
+    auto batch = [&timer, &body, &wall](size_t n) {
+      timer = {};
+      auto start = clock::now();
+      for(size_t i = 0; i != n; i++)
+        body();
+      resume_timing();
+      wall = duration_cast<nanoseconds>(clock::now() - start);
+      return wall - duration_cast<nanoseconds>(timer.paused_for);
+    };
+
+    // Warm up, doubling the batch size as we go so that we also get a good
+    // idea of how long an iteration takes.
+    size_t n = 1;
+    batch(n);
+    auto warm_until = clock::now() + options.warmup;
+    while(clock::now() < warm_until) {
+      n *= 2;
+      batch(n);
+    }
+
+    // Size the batches by wall time, paused time and all, so that a benchmark
+    // that spends most of its time paused still finishes near its target.
+    size_t samples = std::max<size_t>(options.samples, 1);
+    double iteration_time = std::max<double>(wall.count(), 1) / n;
+    double per_sample = duration_cast<nanoseconds>(options.target).count() /
+                        static_cast<double>(samples);
+    size_t iterations = std::max<size_t>(
+      static_cast<size_t>(per_sample / iteration_time), 1
+    );
+
+    auto *counters = active_counters();
+    hw_counters before;
+    if(counters)
+      before = counters->read();
+
+    std::vector<double> times;
+    times.reserve(samples);
+    for(size_t i = 0; i != samples; i++)
+      times.push_back(batch(iterations).count() /
+                      static_cast<double>(iterations));
+
+    auto stats = summarize_samples(std::move(times), iterations);
+    if(counters) {
+      stats.counters = counters_since(before, counters->read());
+      per_iteration(stats.counters, samples * iterations);
+    }
+    return stats;
+  }
+}
+
+} // namespace mettle
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef INC_METTLE_COUNTERS_HPP
+#define INC_METTLE_COUNTERS_HPP
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace mettle {
+
+// Counts from the CPU's performance counters. These are much steadier than
+// wall time on a busy machine. A count is negative if it wasn't available
+// (e.g. because perf_event_paranoid forbids it, or there's no PMU in a VM).
+// Counts are doubles since a benchmark's counts are per iteration, and so can
+// be fractional.
+struct hw_counters {
+  double cycles = -1, instructions = -1, branch_misses = -1;
+  double l1d_misses = -1, llc_misses = -1;
+
+  bool available() const {
+    return cycles >= 0 || instructions >= 0 || branch_misses >= 0 ||
+           l1d_misses >= 0 || llc_misses >= 0;
+  }
+};
+
+namespace detail {
+  constexpr double hw_counters::*counter_fields[] = {
+    &hw_counters::cycles, &hw_counters::instructions,
+    &hw_counters::branch_misses, &hw_counters::l1d_misses,
+    &hw_counters::llc_misses
+  };
+
+  inline hw_counters counters_since(const hw_counters &before,
+                                    const hw_counters &after) {
+    hw_counters result;
+    for(auto field : counter_fields) {
+      if(before.*field >= 0 && after.*field >= 0)
+        result.*field = after.*field - before.*field;
+    }
+    return result;
+  }
+
+  // A group of performance counters for the calling thread, counting only in
+  // user space (which is all that the default perf_event_paranoid setting
+  // allows). Any counter the system won't give us is left out, and if we
+  // can't get any at all, every count just comes back unavailable.
+  class counter_group {
+  public:
+    counter_group() : pid_(getpid()) {
+      auto cache = [](uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      };
+      open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, &hw_counters::cycles);
+      open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+           &hw_counters::instructions);
+      open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+           &hw_counters::branch_misses);
+      open(PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D),
+           &hw_counters::l1d_misses);
+      open(PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL),
+           &hw_counters::llc_misses);
+      enable(true);
+    }
+
+    counter_group(const counter_group &) = delete;
+    counter_group & operator =(const counter_group &) = delete;
+
+    ~counter_group() {
+      for(size_t i = 0; i != size_; i++)
+        close(fds_[i]);
+    }
+
+    bool available() const {
+      return size_ != 0;
+    }
+
+    // The process that opened these counters. A forked child can't use its
+    // parent's counters, since they count the parent.
+    pid_t owner() const {
+      return pid_;
+    }
+
+    void enable(bool on) {
+      if(size_) {
+        ioctl(fds_[0], on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE,
+              PERF_IOC_FLAG_GROUP);
+      }
+    }
+
+    // Read the current counts. If the kernel had to share the hardware with
+    // other counters, the counts are scaled up to make up for the time they
+    // weren't running.
+    hw_counters read() const {
+      hw_counters result;
+      // nr, time_enabled, time_running, then a value for each counter.
+      uint64_t data[3 + max_counters];
+      if(!size_ || ::read(fds_[0], data, sizeof(data)) <
+         static_cast<ssize_t>((3 + size_) * sizeof(uint64_t)))
+        return result;
+
+      uint64_t enabled = data[1], running = data[2];
+      if(running == 0)
+        return result;
+      double scale = static_cast<double>(enabled) / running;
+      for(size_t i = 0; i != size_; i++)
+        result.*fields_[i] = data[3 + i] * scale;
+      return result;
+    }
+  private:
+    static constexpr size_t max_counters = 5;
+
+    void open(uint32_t type, uint64_t config, double hw_counters::*field) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = size_ == 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      int group = size_ ? fds_[0] : -1;
+      int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+      if(fd < 0)
+        return;
+      fds_[size_] = fd;
+      fields_[size_] = field;
+      size_++;
+    }
+
+    pid_t pid_;
+    int fds_[max_counters];
+    double hw_counters::*fields_[max_counters];
+    size_t size_ = 0;
+  };
+
+  inline std::unique_ptr<counter_group> & process_counters() {
+    static std::unique_ptr<counter_group> counters;
+    return counters;
+  }
+
+  // The counters for this process, opening them if need be.
+  inline counter_group & open_counters() {
+    auto &counters = process_counters();
+    if(!counters || counters->owner() != getpid())
+      counters = std::make_unique<counter_group>();
+    return *counters;
+  }
+
+  // The counters for this process, if it's opened any.
+  inline counter_group * active_counters() {
+    auto &counters = process_counters();
+    if(counters && counters->owner() == getpid() && counters->available())
+      return counters.get();
+    return nullptr;
+  }
+}
+
+} // namespace mettle
+
+#endif
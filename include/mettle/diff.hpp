@@ -0,0 +1,471 @@
+#ifndef INC_METTLE_DIFF_HPP
+#define INC_METTLE_DIFF_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "output.hpp"
+
+namespace mettle {
+
+namespace detail {
+  enum class edit_kind { keep, remove, insert };
+
+  // A run of elements that are in both sequences, only in the old one, or
+  // only in the new one. `start` is an index into the new sequence for
+  // inserted elements, and into the old one otherwise.
+  struct diff_edit {
+    edit_kind kind;
+    size_t start, length;
+  };
+
+  // Myers' O(ND) diff, with his linear-space refinement: find the middle snake
+  // of the edit graph by searching from both ends at once, then diff the parts
+  // on either side of it. `equal(i, j)` compares the ith element of the old
+  // sequence to the jth element of the new one. Diffing gives up after `cost`
+  // comparisons, so even huge and wildly different sequences take a bounded
+  // amount of time.
+  template<typename Equal>
+  class sequence_diff {
+  public:
+    sequence_diff(Equal equal, size_t cost)
+      : equal_(std::move(equal)), cost_(cost) {}
+
+    // Diff an old sequence of `old_size` elements with a new one of
+    // `new_size` elements, returning false if it was too expensive.
+    bool run(size_t old_size, size_t new_size) {
+      edits_.clear();
+      diff(0, old_size, 0, new_size);
+      return !exhausted_;
+    }
+
+    const std::vector<diff_edit> & edits() const {
+      return edits_;
+    }
+  private:
+    using index = std::ptrdiff_t;
+
+    bool same(size_t i, size_t j) {
+      if(cost_ == 0) {
+        exhausted_ = true;
+        return false;
+      }
+      cost_--;
+      return equal_(i, j);
+    }
+
+    void add(edit_kind kind, size_t start, size_t length) {
+      if(!length)
+        return;
+      if(!edits_.empty() && edits_.back().kind == kind &&
+         edits_.back().start + edits_.back().length == start)
+        edits_.back().length += length;
+      else
+        edits_.push_back({kind, start, length});
+    }
+
+    void diff(size_t a0, size_t a1, size_t b0, size_t b1) {
+      size_t prefix = 0;
+      while(a0 + prefix != a1 && b0 + prefix != b1 &&
+            same(a0 + prefix, b0 + prefix))
+        prefix++;
+      add(edit_kind::keep, a0, prefix);
+      a0 += prefix;
+      b0 += prefix;
+
+      size_t suffix = 0;
+      while(a1 - suffix != a0 && b1 - suffix != b0 &&
+            same(a1 - suffix - 1, b1 - suffix - 1))
+        suffix++;
+      a1 -= suffix;
+      b1 -= suffix;
+
+      size_t x, y;
+      if(a0 == a1) {
+        add(edit_kind::insert, b0, b1 - b0);
+      }
+      else if(b0 == b1) {
+        add(edit_kind::remove, a0, a1 - a0);
+      }
+      else if(bisect(a0, a1, b0, b1, x, y)) {
+        diff(a0, x, b0, y);
+        diff(x, a1, y, b1);
+      }
+      else {
+        add(edit_kind::remove, a0, a1 - a0);
+        add(edit_kind::insert, b0, b1 - b0);
+      }
+      add(edit_kind::keep, a1, suffix);
+    }
+
+    // Find where the forward and backward searches meet, storing it in
+    // (`x`, `y`). Returns false if they never do, or if the meeting point
+    // doesn't split the problem into smaller ones.
+    bool bisect(size_t a0, size_t a1, size_t b0, size_t b1,
+                size_t &x, size_t &y) {
+      index n = a1 - a0, m = b1 - b0;
+      // Searching out to a distance of d from each end takes at least d^2
+      // comparisons, so don't make room for more than we can afford.
+      index affordable = static_cast<index>(std::sqrt(cost_)) + 1;
+      index max_d = std::min<index>((n + m + 1) / 2, affordable);
+      index offset = max_d + 1, length = 2 * max_d + 3;
+      std::vector<index> forward(length, -1), backward(length, -1);
+      forward[offset + 1] = backward[offset + 1] = 0;
+
+      index delta = n - m;
+      bool odd = delta % 2 != 0;
+      index k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+      auto split = [&](index x1, index y1) {
+        x = a0 + x1;
+        y = b0 + y1;
+        return !(x == a0 && y == b0) && !(x == a1 && y == b1);
+      };
+
+      for(index d = 0; d != max_d && !exhausted_; d++) {
+        for(index k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+          index k1off = offset + k1;
+          index x1 = (k1 == -d || (k1 != d &&
+                                   forward[k1off - 1] < forward[k1off + 1])) ?
+            forward[k1off + 1] : forward[k1off - 1] + 1;
+          index y1 = x1 - k1;
+          while(x1 < n && y1 < m && same(a0 + x1, b0 + y1)) {
+            x1++;
+            y1++;
+          }
+          forward[k1off] = x1;
+
+          if(x1 > n) {
+            k1end += 2;
+          }
+          else if(y1 > m) {
+            k1start += 2;
+          }
+          else if(odd) {
+            index k2off = offset + delta - k1;
+            if(k2off >= 0 && k2off < length && backward[k2off] != -1 &&
+               x1 >= n - backward[k2off])
+              return split(x1, y1);
+          }
+        }
+
+        for(index k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+          index k2off = offset + k2;
+          index x2 = (k2 == -d || (k2 != d &&
+                                   backward[k2off - 1] < backward[k2off + 1])) ?
+            backward[k2off + 1] : backward[k2off - 1] + 1;
+          index y2 = x2 - k2;
+          while(x2 < n && y2 < m && same(a1 - x2 - 1, b1 - y2 - 1)) {
+            x2++;
+            y2++;
+          }
+          backward[k2off] = x2;
+
+          if(x2 > n) {
+            k2end += 2;
+          }
+          else if(y2 > m) {
+            k2start += 2;
+          }
+          else if(!odd) {
+            index k1off = offset + delta - k2;
+            if(k1off >= 0 && k1off < length && forward[k1off] != -1) {
+              index x1 = forward[k1off];
+              if(x1 >= n - x2)
+                return split(x1, x1 - (k1off - offset));
+            }
+          }
+        }
+      }
+
+      // The searches always meet by the time they've covered half of the
+      // longest possible edit script, so if they didn't, we ran out of room.
+      if(max_d < (n + m + 1) / 2)
+        exhausted_ = true;
+      return false;
+    }
+
+    Equal equal_;
+    size_t cost_;
+    bool exhausted_ = false;
+    std::vector<diff_edit> edits_;
+  };
+
+  template<typename Equal>
+  inline sequence_diff<Equal> make_sequence_diff(Equal equal, size_t cost) {
+    return sequence_diff<Equal>(std::move(equal), cost);
+  }
+
+  // How to show a diff of one kind of sequence: the delimiters around the
+  // whole thing and between elements, and how many unchanged elements to show
+  // around each change.
+  struct diff_style {
+    const char *open, *close, *separator;
+    size_t context;
+  };
+
+  // Show a diff of two sequences inline, with removed elements written like
+  // `[-this-]` and inserted ones like `{+this+}`. Long runs of unchanged
+  // elements are elided. `print_old(s, i)` and `print_new(s, i)` write the ith
+  // element of each sequence to `s`.
+  template<typename PrintOld, typename PrintNew>
+  std::string format_diff(const std::vector<diff_edit> &edits,
+                          const diff_style &style, const PrintOld &print_old,
+                          const PrintNew &print_new) {
+    std::ostringstream s;
+    const auto limit = static_cast<std::streamoff>(
+      current_print_limits().bytes
+    );
+    bool first = true;
+    auto next = [&]() {
+      if(!first)
+        s << style.separator;
+      first = false;
+    };
+    auto run = [&](const auto &print, size_t start, size_t length) {
+      for(size_t i = 0; i != length; i++) {
+        if(i)
+          s << style.separator;
+        if(s.tellp() > limit) {
+          s << "...";
+          return;
+        }
+        print(s, start + i);
+      }
+    };
+
+    s << style.open;
+    for(size_t i = 0; i != edits.size(); i++) {
+      if(s.tellp() > limit) {
+        next();
+        s << "...";
+        break;
+      }
+
+      if(edits[i].kind == edit_kind::keep) {
+        const auto &e = edits[i];
+        size_t head = i == 0 ? 0 : std::min(style.context, e.length);
+        size_t tail = i == edits.size() - 1 ? 0 :
+                      std::min(style.context, e.length - head);
+        if(head) {
+          next();
+          run(print_old, e.start, head);
+        }
+        if(head + tail != e.length) {
+          next();
+          s << "...";
+        }
+        if(tail) {
+          next();
+          run(print_old, e.start + e.length - tail, tail);
+        }
+        continue;
+      }
+
+      // Removals and insertions between two unchanged runs are each
+      // contiguous, so gather them up and show all the removals first.
+      size_t removed_start = 0, removed = 0, inserted_start = 0, inserted = 0;
+      for(; i != edits.size() && edits[i].kind != edit_kind::keep; i++) {
+        if(edits[i].kind == edit_kind::remove) {
+          if(!removed)
+            removed_start = edits[i].start;
+          removed += edits[i].length;
+        }
+        else {
+          if(!inserted)
+            inserted_start = edits[i].start;
+          inserted += edits[i].length;
+        }
+      }
+      i--;
+
+      if(removed) {
+        next();
+        s << "[-";
+        run(print_old, removed_start, removed);
+        s << "-]";
+      }
+      if(inserted) {
+        next();
+        s << "{+";
+        run(print_new, inserted_start, inserted);
+        s << "+}";
+      }
+    }
+    s << style.close;
+    return s.str();
+  }
+
+  // Describe the differences found by a diff, or return an empty string if
+  // there's nothing useful to say (e.g. if the sequences have nothing in
+  // common, a diff is no clearer than the values themselves).
+  template<typename Diff, typename PrintOld, typename PrintNew>
+  std::string describe_diff(Diff &diff, size_t old_size, size_t new_size,
+                            const diff_style &style,
+                            const PrintOld &print_old,
+                            const PrintNew &print_new) {
+    if(!diff.run(old_size, new_size))
+      return "too many differences to diff";
+
+    const auto &edits = diff.edits();
+    bool common = std::any_of(edits.begin(), edits.end(), [](const auto &e) {
+      return e.kind == edit_kind::keep;
+    });
+    if(!common)
+      return "";
+
+    size_t first = edits.front().kind == edit_kind::keep ?
+                   edits.front().length : 0;
+    return "first difference at index " + std::to_string(first) + ": " +
+           format_diff(edits, style, print_old, print_new);
+  }
+
+  template<typename T>
+  struct is_string_like : std::false_type {};
+
+  template<typename Traits, typename Alloc>
+  struct is_string_like<std::basic_string<char, Traits, Alloc>>
+    : std::true_type {};
+
+  template<> struct is_string_like<const char *> : std::true_type {};
+  template<> struct is_string_like<char *> : std::true_type {};
+
+  template<size_t N>
+  struct is_string_like<char[N]> : std::true_type {};
+
+  struct char_range {
+    const char *data;
+    size_t size;
+  };
+
+  template<typename Traits, typename Alloc>
+  inline char_range chars_of(const std::basic_string<char, Traits, Alloc> &s) {
+    return {s.data(), s.size()};
+  }
+
+  inline char_range chars_of(const char *s) {
+    return {s, std::strlen(s)};
+  }
+
+  // Random access to the elements of an iterable, copying its iterators first
+  // if it doesn't support that itself.
+  template<typename T, typename Iter = decltype(std::begin(
+    std::declval<const T &>()
+  )), bool = std::is_base_of<
+    std::random_access_iterator_tag,
+    typename std::iterator_traits<Iter>::iterator_category
+  >::value>
+  class indexed_range {
+  public:
+    indexed_range(const T &range)
+      : begin_(std::begin(range)),
+        size_(std::distance(begin_, std::end(range))) {}
+
+    size_t size() const {
+      return size_;
+    }
+
+    decltype(auto) operator [](size_t i) const {
+      return begin_[i];
+    }
+  private:
+    Iter begin_;
+    size_t size_;
+  };
+
+  template<typename T, typename Iter>
+  class indexed_range<T, Iter, false> {
+  public:
+    indexed_range(const T &range) {
+      for(auto i = std::begin(range); i != std::end(range); ++i)
+        iters_.push_back(i);
+    }
+
+    size_t size() const {
+      return iters_.size();
+    }
+
+    decltype(auto) operator [](size_t i) const {
+      return *iters_[i];
+    }
+  private:
+    std::vector<Iter> iters_;
+  };
+
+  template<typename T>
+  struct is_diffable_sequence : std::integral_constant<bool,
+    is_iterable<const T &>::value &&
+    !is_string_like<std::remove_cv_t<T>>::value &&
+    (!is_printable<T>::value || std::is_array<T>::value)
+  > {};
+
+  template<typename Old, typename New>
+  struct is_diffable_strings : std::integral_constant<bool,
+    is_string_like<std::remove_cv_t<Old>>::value &&
+    is_string_like<std::remove_cv_t<New>>::value
+  > {};
+
+  template<typename Old, typename New, typename = void>
+  struct is_diffable_sequences : std::false_type {};
+
+  template<typename Old, typename New>
+  struct is_diffable_sequences<Old, New, decltype(
+    *std::begin(std::declval<const Old &>()) ==
+    *std::begin(std::declval<const New &>()),
+    void()
+  )> : std::integral_constant<bool,
+    is_diffable_sequence<Old>::value && is_diffable_sequence<New>::value
+  > {};
+
+  // Whether diff_values() can show how two values differ.
+  template<typename Old, typename New>
+  struct is_diffable : std::integral_constant<bool,
+    is_diffable_strings<Old, New>::value ||
+    is_diffable_sequences<Old, New>::value
+  > {};
+
+  template<typename Old, typename New>
+  auto diff_values(const Old &old_value, const New &new_value)
+    -> typename std::enable_if<
+      is_diffable_strings<Old, New>::value, std::string
+    >::type {
+    auto a = chars_of(old_value), b = chars_of(new_value);
+    auto diff = make_sequence_diff([a, b](size_t i, size_t j) {
+      return a.data[i] == b.data[j];
+    }, current_print_limits().diff_cost);
+    auto print = [](const char_range &r) {
+      return [r](std::ostream &s, size_t i) { write_escaped(s, r.data[i]); };
+    };
+    return describe_diff(diff, a.size, b.size, {"\"", "\"", "", 16},
+                         print(a), print(b));
+  }
+
+  template<typename Old, typename New>
+  auto diff_values(const Old &old_value, const New &new_value)
+    -> typename std::enable_if<
+      is_diffable_sequences<Old, New>::value, std::string
+    >::type {
+    indexed_range<Old> a(old_value);
+    indexed_range<New> b(new_value);
+    auto diff = make_sequence_diff([&a, &b](size_t i, size_t j) {
+      return a[i] == b[j];
+    }, current_print_limits().diff_cost);
+    auto print = [](const auto &r) {
+      return [&r](std::ostream &s, size_t i) { s << ensure_printable(r[i]); };
+    };
+    return describe_diff(diff, a.size(), b.size(), {"[", "]", ", ", 2},
+                         print(a), print(b));
+  }
+}
+
+} // namespace mettle
+
+#endif
@@ -1,300 +1,51 @@
 #ifndef INC_METTLE_DRIVER_HPP
 #define INC_METTLE_DRIVER_HPP
 
-#include <cmath>
-#include <iomanip>
+#include <chrono>
+#include <fstream>
 #include <iostream>
 #include <boost/program_options.hpp>
 
+#include "baseline.hpp"
 #include "glue.hpp"
+#include "history.hpp"
+#include "loggers.hpp"
+#include "results.hpp"
 #include "term.hpp"
 #include "runner.hpp"
 
 namespace mettle {
 
 using suites_list = std::vector<runnable_suite>;
+using suite_factories = std::vector<suite_factory>;
 
 namespace detail {
-  suites_list all_suites;
-
-  class verbose_logger {
-  public:
-    verbose_logger(std::ostream &out, unsigned int verbosity)
-      : out(out), verbosity_(verbosity), first_(true), base_indent_(0) {}
-
-    void start_run() {
-      first_ = true;
-      if(verbosity_ == 1)
-        out << std::string(base_indent_, ' ');
-    }
-
-    void end_run() {
-      if(verbosity_ == 1)
-        out << std::endl;
-    }
-
-    void start_suite(const std::vector<std::string> &suites) {
-      using namespace term;
-      if(verbosity_ >= 2) {
-        if(!first_)
-          out << std::endl;
-        first_ = false;
-
-        const std::string indent((suites.size() - 1) * 2 + base_indent_, ' ');
-        out << indent << format(sgr::bold) << suites.back() << reset()
-            << std::endl;
-      }
-    }
-
-    void end_suite(const std::vector<std::string> &) {}
-
-    void start_test(const test_name &test) {
-      if(verbosity_ >= 2) {
-        const std::string indent(test.suites.size() * 2 + base_indent_, ' ');
-        out << indent << test.test << " " << std::flush;
-      }
-    }
-
-    void passed_test(const test_name &) {
-      using namespace term;
-      if(verbosity_ == 0) {
-        return;
-      }
-      else if(verbosity_ == 1) {
-        out << format(sgr::bold, fg(color::green)) << "." << reset()
-            << std::flush;
-      }
-      else {
-        out << format(sgr::bold, fg(color::green)) << "PASSED" << reset()
-            << std::endl;
-      }
-    }
-
-    void skipped_test(const test_name &) {
-      using namespace term;
-      if(verbosity_ == 0) {
-        return;
-      }
-      else if(verbosity_ == 1) {
-        out << format(sgr::bold, fg(color::blue)) << "_" << reset()
-            << std::flush;
-      }
-      else {
-        out << format(sgr::bold, fg(color::blue)) << "SKIPPED" << reset()
-            << std::endl;
-      }
-    }
-
-    void failed_test(const test_name &, const std::string &message) {
-      using namespace term;
-      if(verbosity_ == 0) {
-        return;
-      }
-      else if(verbosity_ == 1) {
-        out << format(sgr::bold, fg(color::red)) << "!" << reset()
-            << std::flush;
-      }
-      else {
-        out << format(sgr::bold, fg(color::red)) << "FAILED" << reset() << ": "
-            << message << std::endl;
-      }
-    }
-
-    unsigned int verbosity() const {
-      return verbosity_;
-    }
-
-    void indent(size_t n) {
-      base_indent_ = n;
-    }
-
-    std::ostream &out;
-  private:
-    unsigned int verbosity_;
-    bool first_;
-    size_t base_indent_;
-  };
-
-  class single_run_logger : public test_logger {
-  public:
-    single_run_logger(verbose_logger vlog)
-      : vlog_(vlog), total_(0), passes_(0), skips_(0) {}
-
-    void start_run() {
-      vlog_.start_run();
-    }
-
-    void end_run() {
-      vlog_.end_run();
-    }
-
-    void start_suite(const std::vector<std::string> &suites) {
-      vlog_.start_suite(suites);
-    }
-
-    void end_suite(const std::vector<std::string> &suites) {
-      vlog_.end_suite(suites);
-    }
-
-    void start_test(const test_name &test) {
-      total_++;
-      vlog_.start_test(test);
-    }
-
-    void passed_test(const test_name &test) {
-      passes_++;
-      vlog_.passed_test(test);
-    }
-
-    void skipped_test(const test_name &test) {
-      skips_++;
-      vlog_.skipped_test(test);
-    }
-
-    void failed_test(const test_name &test, const std::string &message) {
-      failures_.push_back({test, message});
-      vlog_.failed_test(test, message);
-    }
-
-    void summarize() {
-      using namespace term;
-
-      if(vlog_.verbosity())
-        vlog_.out << std::endl;
-
-      vlog_.out << format(sgr::bold) << passes_ << "/" << total_
-                << " tests passed";
-      if(skips_)
-        vlog_.out << " (" << skips_ << " skipped)";
-      vlog_.out << reset() << std::endl;
-
-      for(const auto &i : failures_) {
-        vlog_.out << "  " << i.test.full_name() << " "
-                  << format(sgr::bold, fg(color::red)) << "FAILED" << reset()
-                  << ": " << i.message << std::endl;
-      }
-    }
-
-    size_t failures() const {
-      return failures_.size();
-    }
-  private:
-    struct failure {
-      test_name test;
-      std::string message;
-    };
-
-    verbose_logger vlog_;
-    size_t total_, passes_, skips_;
-    std::vector<const failure> failures_;
-  };
-
-  class multi_run_logger : public test_logger {
-  public:
-    multi_run_logger(verbose_logger vlog)
-      : vlog_(vlog), total_(0), skips_(0), runs_(0) {
-      if(vlog_.verbosity() == 2)
-        vlog_.indent(2);
-    }
-
-    void start_run() {
-      using namespace term;
-      runs_++;
-      total_ = skips_ = 0;
-
-      if(vlog_.verbosity() == 2) {
-        if(runs_ > 1)
-          vlog_.out << std::endl;
-        vlog_.out << format(sgr::bold) << "Test run" << reset() << " "
-                  << format(sgr::bold, fg(color::yellow)) << "[#" << runs_
-                  << "]" << reset() << std::endl << std::endl;
-      }
-      vlog_.start_run();
-    }
-
-    void end_run() {
-      vlog_.end_run();
-    }
-
-    void start_suite(const std::vector<std::string> &suites) {
-      vlog_.start_suite(suites);
-    }
-
-    void end_suite(const std::vector<std::string> &suites) {
-      vlog_.end_suite(suites);
-    }
-
-    void start_test(const test_name &test) {
-      total_++;
-      vlog_.start_test(test);
-    }
-
-    void passed_test(const test_name &test) {
-      vlog_.passed_test(test);
+  // Suites declared at namespace scope only register how to build themselves;
+  // we build the ones we need once we know what's being run.
+  suite_factories all_suites;
+
+  inline suites_list
+  build_suites(const suite_factories &factories, const test_filter &filter) {
+    suites_list suites;
+    for(const auto &i : factories) {
+      if(filter.check_suite({i.name}))
+        suites.push_back(i.make());
     }
-
-    void skipped_test(const test_name &test) {
-      skips_++;
-      vlog_.skipped_test(test);
-    }
-
-    void failed_test(const test_name &test, const std::string &message) {
-      failures_[test].push_back({runs_, message});
-      vlog_.failed_test(test, message);
-    }
-
-    void summarize() {
-      using namespace term;
-      size_t passes = total_ - skips_ - failures_.size();
-
-      if(vlog_.verbosity())
-        vlog_.out << std::endl;
-
-      vlog_.out << format(sgr::bold) << passes << "/" << total_
-                << " tests passed";
-      if(skips_)
-        vlog_.out << " (" << skips_ << " skipped)";
-      vlog_.out << reset() << std::endl;
-
-      int run_width = std::ceil(std::log10(runs_));
-      for(const auto &i : failures_) {
-        format fail_count_fmt(
-          sgr::bold, fg(i.second.size() == runs_ ? color::red : color::yellow)
-        );
-        vlog_.out << "  " << i.first.full_name() << " "
-                  << format(sgr::bold, fg(color::red)) << "FAILED" << reset()
-                  << " " << fail_count_fmt << "[" << i.second.size() << "/"
-                  << runs_ << "]" << reset() << ":" << std::endl;
-
-        for(const auto &j : i.second) {
-          vlog_.out << "    " << j.message << " "
-                    << format(sgr::bold, fg(color::yellow)) << "["
-                    << std::setw(run_width) << j.run << "]" << reset()
-                    << std::endl;
-        }
-      }
-    }
-
-    size_t failures() const {
-      return failures_.size();
-    }
-  private:
-    struct failure {
-      size_t run;
-      std::string message;
-    };
-
-    verbose_logger vlog_;
-    size_t total_, skips_, runs_;
-    std::map<test_name, std::vector<const failure>> failures_;
-  };
+    return suites;
+  }
 }
 
 template<typename Exception, typename ...Fixture>
 struct basic_suite {
   template<typename F>
   basic_suite(const std::string &name, const F &f,
-              suites_list &suites = detail::all_suites) {
+              suite_factories &factories = detail::all_suites) {
+    for (auto &i : make_suite_factories<Exception, Fixture...>(name, f))
+      factories.push_back(std::move(i));
+  }
+
+  template<typename F>
+  basic_suite(const std::string &name, const F &f, suites_list &suites) {
     for (auto &i : make_basic_suites<Exception, Fixture...>(name, f))
       suites.push_back(std::move(i));
   }
@@ -317,6 +68,39 @@ int main(int argc, const char *argv[]) {
     ("color", "show colored output")
     ("runs", opts::value<size_t>(), "number of test runs")
     ("no-fork", "don't fork for each test")
+    ("jobs,j", opts::value<size_t>(), "number of tests to run in parallel")
+    ("worker-pool", "run tests in long-lived worker processes")
+    ("timeout", opts::value<size_t>(), "timeout for each test (in ms)")
+    ("slowest", opts::value<size_t>(), "show the N slowest tests")
+    ("top-memory", opts::value<size_t>(),
+     "show the N tests that used the most memory")
+    ("top-cpu", opts::value<size_t>(),
+     "show the N tests that used the most CPU time")
+    ("top-allocations", opts::value<size_t>(),
+     "show the N tests that allocated the most memory")
+    ("history", opts::value<std::string>(),
+     "file to record test durations and outcomes in")
+    ("longest-first", "run the slowest tests first (requires --history)")
+    ("failed-first", "run tests that failed last time first (requires "
+     "--history)")
+    ("fail-fast", opts::value<size_t>()->implicit_value(1),
+     "stop after N failures")
+    ("filter", opts::value<std::vector<std::string>>(),
+     "only run tests matching this pattern")
+    ("exclude", opts::value<std::vector<std::string>>(),
+     "don't run tests matching this pattern")
+    ("shard", opts::value<std::string>(),
+     "only run part I of N of the tests (as I/N)")
+    ("results-file", opts::value<std::string>(),
+     "file to write machine-readable results to")
+    ("bench-baseline", opts::value<std::string>(),
+     "fail benchmarks that are slower than in this file")
+    ("bench-threshold", opts::value<double>(),
+     "how much slower (in %) a benchmark can be than its baseline")
+    ("bench-save", opts::value<std::string>(),
+     "file to save benchmark results to, as a baseline")
+    ("perf-counters", "count hardware events (cycles, instructions, etc.) "
+     "for each test")
   ;
 
   opts::variables_map args;
@@ -331,10 +115,165 @@ int main(int argc, const char *argv[]) {
   unsigned int verbosity = args.count("verbose") ?
     args["verbose"].as<unsigned int>() : 0;
   term::colors_enabled = args.count("color");
-  bool fork_tests = !args.count("no-fork");
+  mettle::run_options options;
+  options.fork_tests = !args.count("no-fork");
+  options.worker_pool = args.count("worker-pool");
+
+  if(args.count("perf-counters")) {
+    options.hw_counters = true;
+    if(!open_counters().available()) {
+      std::cerr << "hardware counters unavailable (check "
+                << "/proc/sys/kernel/perf_event_paranoid); continuing without "
+                << "them" << std::endl;
+    }
+  }
+
+  if(args.count("timeout"))
+    options.timeout = std::chrono::milliseconds(args["timeout"].as<size_t>());
+
+  options.jobs = args.count("jobs") ? args["jobs"].as<size_t>() : 1;
+  if(options.jobs == 0) {
+    std::cout << "no jobs, exiting" << std::endl;
+    return 1;
+  }
 
   verbose_logger vlog(std::cout, verbosity);
 
+  std::unique_ptr<mettle::history_store> history;
+  if(args.count("history")) {
+    history = std::make_unique<mettle::history_store>(
+      args["history"].as<std::string>()
+    );
+  }
+
+  bool failed_first = args.count("failed-first");
+  bool longest_first = args.count("longest-first");
+  if(failed_first || longest_first) {
+    if(!history) {
+      std::cout << (failed_first ? "--failed-first" : "--longest-first")
+                << " requires --history" << std::endl;
+      return 1;
+    }
+    options.order = mettle::history_order(*history, failed_first,
+                                          longest_first);
+  }
+
+  if(args.count("fail-fast"))
+    options.fail_fast = args["fail-fast"].as<size_t>();
+
+  try {
+    if(args.count("filter")) {
+      for(const auto &i : args["filter"].as<std::vector<std::string>>())
+        options.filter.include(i);
+    }
+    if(args.count("exclude")) {
+      for(const auto &i : args["exclude"].as<std::vector<std::string>>())
+        options.filter.exclude(i);
+    }
+  }
+  catch(const std::regex_error &e) {
+    std::cout << "invalid pattern: " << e.what() << std::endl;
+    return 1;
+  }
+
+  if(args.count("shard")) {
+    std::istringstream ss(args["shard"].as<std::string>());
+    size_t index, count;
+    char slash;
+    if(!(ss >> index >> slash >> count) || !ss.eof() || slash != '/' ||
+       index == 0 || index > count) {
+      std::cout << "invalid shard " << args["shard"].as<std::string>()
+                << std::endl;
+      return 1;
+    }
+
+    options.shard.index = index - 1;
+    options.shard.count = count;
+    if(history)
+      options.shard.cost = mettle::history_cost(*history);
+  }
+
+  std::ofstream results_file;
+  if(args.count("results-file")) {
+    auto path = args["results-file"].as<std::string>();
+    results_file.open(path);
+    if(!results_file) {
+      std::cout << "unable to open " << path << std::endl;
+      return 1;
+    }
+  }
+
+  std::unique_ptr<mettle::bench_baseline> baseline;
+  if(args.count("bench-baseline")) {
+    auto path = args["bench-baseline"].as<std::string>();
+    baseline = std::make_unique<mettle::bench_baseline>();
+    if(!baseline->load(path)) {
+      std::cout << "unable to read baseline " << path << std::endl;
+      return 1;
+    }
+  }
+
+  double bench_threshold = args.count("bench-threshold") ?
+    args["bench-threshold"].as<double>() / 100 : 0.1;
+
+  auto suites = build_suites(all_suites, options.filter);
+
+  auto run = [&](auto &logger, size_t runs) {
+    mettle::logger_group loggers{&logger};
+    std::unique_ptr<mettle::history_logger> hlog;
+    if(history) {
+      hlog = std::make_unique<mettle::history_logger>(*history);
+      loggers.add(*hlog);
+    }
+
+    std::unique_ptr<mettle::results_logger> rlog;
+    if(results_file.is_open()) {
+      rlog = std::make_unique<mettle::results_logger>(
+        results_file, options.shard.index, options.shard.count
+      );
+      loggers.add(*rlog);
+    }
+
+    // Regressions are turned into failures before the loggers see them, but
+    // the new baseline should record every benchmark as it ran.
+    mettle::logger_group root;
+    std::unique_ptr<mettle::baseline_checker> checker;
+    if(baseline) {
+      checker = std::make_unique<mettle::baseline_checker>(
+        loggers, *baseline, bench_threshold
+      );
+      root.add(*checker);
+    }
+    else {
+      root.add(loggers);
+    }
+
+    mettle::bench_baseline saved;
+    mettle::baseline_logger blog(saved);
+    if(args.count("bench-save"))
+      root.add(blog);
+
+    for(size_t i = 0; i < runs; i++)
+      run_tests(suites, root, options);
+    logger.summarize();
+
+    if(history && !history->save()) {
+      std::cerr << "unable to save history to " << history->path() << ": "
+                << strerror(errno) << std::endl;
+    }
+    if(args.count("bench-save")) {
+      auto path = args["bench-save"].as<std::string>();
+      if(!saved.save(path)) {
+        std::cerr << "unable to save benchmarks to " << path << ": "
+                  << strerror(errno) << std::endl;
+      }
+    }
+    return logger.failures();
+  };
+
+  // Forked tests take whatever they leave behind with them when they exit.
+  bool show_growth = !options.fork_tests;
+
   if(args.count("runs")) {
     size_t runs = args["runs"].as<size_t>();
     if(runs == 0) {
@@ -342,19 +281,28 @@ int main(int argc, const char *argv[]) {
       return 1;
     }
 
-    multi_run_logger logger(vlog);
-    for(size_t i = 0; i < runs; i++)
-      run_tests(all_suites, logger, fork_tests);
-    logger.summarize();
+    // The summary for multiple runs only lists failures.
+    for(const char *i : {"slowest", "top-memory", "top-cpu",
+                         "top-allocations"}) {
+      if(args.count(i)) {
+        std::cout << "--" << i << " can't be used with --runs" << std::endl;
+        return 1;
+      }
+    }
 
-    return logger.failures();
+    multi_run_logger logger(vlog, show_growth);
+    return run(logger, runs);
   }
   else {
-    single_run_logger logger(vlog);
-    run_tests(all_suites, logger, fork_tests);
-    logger.summarize();
-
-    return logger.failures();
+    size_t slowest = args.count("slowest") ? args["slowest"].as<size_t>() : 0;
+    size_t top_memory = args.count("top-memory") ?
+      args["top-memory"].as<size_t>() : 0;
+    size_t top_cpu = args.count("top-cpu") ? args["top-cpu"].as<size_t>() : 0;
+    size_t top_allocations = args.count("top-allocations") ?
+      args["top-allocations"].as<size_t>() : 0;
+    single_run_logger logger(vlog, slowest, top_memory, top_cpu,
+                             top_allocations, show_growth);
+    return run(logger, 1);
   }
 }
 
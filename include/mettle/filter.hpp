@@ -0,0 +1,108 @@
+#ifndef INC_METTLE_FILTER_HPP
+#define INC_METTLE_FILTER_HPP
+
+#include <algorithm>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace mettle {
+
+// Selects tests by name. A pattern is a list of regular expressions separated
+// by " > ", just like a test's full name; each one is searched for in the
+// corresponding part of the name. A pattern matches a test if it matches the
+// start of the test's name, so "suite" selects everything in that suite (and
+// any suite with "suite" in its name!), while "^suite$ > ^test$" selects a
+// single test.
+//
+// A test is selected if it matches any of the included patterns (or if there
+// are none) and doesn't match any of the excluded ones. The runner checks
+// suites as it goes, so that it never looks at the tests in a suite that can't
+// contain anything selected.
+class test_filter {
+public:
+  // Throws std::regex_error if the pattern isn't valid.
+  void include(const std::string &pattern) {
+    include_.push_back(parse(pattern));
+  }
+
+  void exclude(const std::string &pattern) {
+    exclude_.push_back(parse(pattern));
+  }
+
+  bool empty() const {
+    return include_.empty() && exclude_.empty();
+  }
+
+  // Could any of the tests in the suite named by `suites` (or its subsuites)
+  // be selected?
+  bool check_suite(const std::vector<std::string> &suites) const {
+    for(const auto &pattern : exclude_) {
+      if(pattern.size() <= suites.size() &&
+         matches(pattern, pattern.size(), suites, nullptr))
+        return false;
+    }
+
+    if(include_.empty())
+      return true;
+    for(const auto &pattern : include_) {
+      if(matches(pattern, std::min(pattern.size(), suites.size()), suites,
+                 nullptr))
+        return true;
+    }
+    return false;
+  }
+
+  bool operator ()(const std::vector<std::string> &suites,
+                   const std::string &test) const {
+    size_t size = suites.size() + 1;
+    for(const auto &pattern : exclude_) {
+      if(pattern.size() <= size &&
+         matches(pattern, pattern.size(), suites, &test))
+        return false;
+    }
+
+    if(include_.empty())
+      return true;
+    for(const auto &pattern : include_) {
+      if(pattern.size() <= size &&
+         matches(pattern, pattern.size(), suites, &test))
+        return true;
+    }
+    return false;
+  }
+private:
+  using pattern_type = std::vector<std::regex>;
+
+  static pattern_type parse(const std::string &pattern) {
+    static const std::string separator = " > ";
+
+    pattern_type result;
+    size_t start = 0, end;
+    do {
+      end = pattern.find(separator, start);
+      result.emplace_back(pattern.substr(start, end - start));
+      start = end + separator.size();
+    } while(end != std::string::npos);
+    return result;
+  }
+
+  // Check the first `n` parts of `pattern` against the name made up of
+  // `suites` followed by `test` (if any).
+  static bool matches(const pattern_type &pattern, size_t n,
+                      const std::vector<std::string> &suites,
+                      const std::string *test) {
+    for(size_t i = 0; i != n; i++) {
+      const auto &part = i < suites.size() ? suites[i] : *test;
+      if(!std::regex_search(part, pattern[i]))
+        return false;
+    }
+    return true;
+  }
+
+  std::vector<pattern_type> include_, exclude_;
+};
+
+} // namespace mettle
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef INC_METTLE_HISTORY_HPP
+#define INC_METTLE_HISTORY_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "runner.hpp"
+
+namespace mettle {
+
+enum class test_outcome : uint8_t {
+  passed    = 0,
+  failed    = 1,
+  timed_out = 2
+};
+
+// What we remember about a test from earlier runs. Durations are smoothed
+// across runs so that one noisy run doesn't throw off scheduling decisions.
+struct test_history {
+  size_t runs;
+  size_t failures;
+  test_outcome last_outcome;
+  std::chrono::nanoseconds last_duration;
+  std::chrono::nanoseconds mean_duration;
+  std::chrono::nanoseconds mean_cpu;
+  long max_rss; // In kilobytes.
+};
+
+namespace detail {
+  // The on-disk format is a short header followed by a flat array of these
+  // records, keyed by the stable_hash() of the test's full name. Hashing keeps
+  // records small and fixed-size, and with 64 bits, collisions aren't a
+  // practical worry. Each run appends one record per test; when the file has
+  // grown enough, it's rewritten with a single merged record per test. The
+  // file is in native byte order, since it's only meant to be a local cache.
+  struct history_record {
+    uint64_t key;
+    uint32_t runs;
+    uint32_t failures;
+    uint8_t last_outcome;
+    uint8_t padding[7];
+    int64_t last_duration;
+    int64_t mean_duration;
+    int64_t mean_cpu;
+    int64_t max_rss;
+  };
+
+  constexpr char history_magic[4] = {'M', 'T', 'L', 'H'};
+  constexpr uint32_t history_version = 1;
+
+  // How much weight a new run gets in the smoothed durations.
+  constexpr double history_smoothing = 0.3;
+
+  inline void merge_history(history_record &into,
+                            const history_record &from) {
+    auto smooth = [](int64_t old, int64_t latest) {
+      return static_cast<int64_t>(old + (latest - old) * history_smoothing);
+    };
+
+    into.runs += from.runs;
+    into.failures += from.failures;
+    into.last_outcome = from.last_outcome;
+    into.last_duration = from.last_duration;
+    into.mean_duration = smooth(into.mean_duration, from.mean_duration);
+    into.mean_cpu = smooth(into.mean_cpu, from.mean_cpu);
+    into.max_rss = std::max(into.max_rss, from.max_rss);
+  }
+}
+
+class history_store {
+public:
+  explicit history_store(std::string path) : path_(std::move(path)) {
+    load();
+  }
+
+  const std::string & path() const {
+    return path_;
+  }
+
+  size_t size() const {
+    return records_.size();
+  }
+
+  // The average of the smoothed durations of every test we know about.
+  std::chrono::nanoseconds mean_duration() const {
+    if(records_.empty())
+      return std::chrono::nanoseconds(0);
+
+    double total = 0;
+    for(const auto &i : records_)
+      total += i.second.mean_duration;
+    return std::chrono::nanoseconds(
+      static_cast<int64_t>(total / records_.size())
+    );
+  }
+
+  bool find(const test_name &test, test_history &history) const {
+    auto i = records_.find(detail::stable_hash(test.full_name()));
+    if(i == records_.end())
+      return false;
+
+    const auto &r = i->second;
+    history = {
+      r.runs, r.failures, static_cast<test_outcome>(r.last_outcome),
+      std::chrono::nanoseconds(r.last_duration),
+      std::chrono::nanoseconds(r.mean_duration),
+      std::chrono::nanoseconds(r.mean_cpu), static_cast<long>(r.max_rss)
+    };
+    return true;
+  }
+
+  void record(const test_name &test, test_outcome outcome,
+              const test_metrics &metrics) {
+    auto total = metrics.timing.total();
+    detail::history_record r = {};
+    r.key = detail::stable_hash(test.full_name());
+    r.runs = 1;
+    r.failures = outcome != test_outcome::passed;
+    r.last_outcome = static_cast<uint8_t>(outcome);
+    r.last_duration = r.mean_duration = total.wall.count();
+    r.mean_cpu = total.cpu.count();
+    r.max_rss = metrics.usage.max_rss;
+
+    pending_.push_back(r);
+    merge(r);
+  }
+
+  // Write out everything recorded since the last save. Returns false (with
+  // errno set) if the file couldn't be written.
+  bool save() {
+    bool ok;
+    if(!valid_file_ || file_records_ + pending_.size() > 4 * records_.size())
+      ok = compact();
+    else
+      ok = append();
+
+    if(ok)
+      pending_.clear();
+    return ok;
+  }
+private:
+  void load() {
+    FILE *f = fopen(path_.c_str(), "rb");
+    if(!f)
+      return;
+
+    char magic[sizeof(detail::history_magic)];
+    uint32_t version;
+    if(fread(magic, sizeof(magic), 1, f) == 1 &&
+       fread(&version, sizeof(version), 1, f) == 1 &&
+       std::memcmp(magic, detail::history_magic, sizeof(magic)) == 0 &&
+       version == detail::history_version) {
+      valid_file_ = true;
+
+      std::vector<detail::history_record> chunk(4096);
+      size_t n;
+      while((n = fread(chunk.data(), sizeof(chunk[0]), chunk.size(), f)) > 0) {
+        for(size_t i = 0; i != n; i++)
+          merge(chunk[i]);
+        file_records_ += n;
+      }
+
+      // A partial record at the end (e.g. from an interrupted save) would throw
+      // off everything appended after it, so drop it by rewriting the file the
+      // next time we save.
+      long size = sizeof(magic) + sizeof(version) +
+                  file_records_ * sizeof(detail::history_record);
+      if(ftell(f) != size)
+        valid_file_ = false;
+    }
+    fclose(f);
+  }
+
+  void merge(const detail::history_record &r) {
+    auto i = records_.find(r.key);
+    if(i == records_.end())
+      records_.emplace(r.key, r);
+    else
+      detail::merge_history(i->second, r);
+  }
+
+  bool append() {
+    FILE *f = fopen(path_.c_str(), "ab");
+    if(!f)
+      return false;
+    bool ok = fwrite(pending_.data(), sizeof(pending_[0]), pending_.size(),
+                     f) == pending_.size();
+    ok = (fclose(f) == 0) && ok;
+    if(ok)
+      file_records_ += pending_.size();
+    return ok;
+  }
+
+  // Rewrite the whole file with one record per test. We write to a temporary
+  // file first so that an interrupted save doesn't lose the history.
+  bool compact() {
+    std::string temp = path_ + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if(!f)
+      return false;
+
+    bool ok = fwrite(detail::history_magic, sizeof(detail::history_magic), 1,
+                     f) == 1 &&
+              fwrite(&detail::history_version,
+                     sizeof(detail::history_version), 1, f) == 1;
+    for(const auto &i : records_) {
+      if(!ok)
+        break;
+      ok = fwrite(&i.second, sizeof(i.second), 1, f) == 1;
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if(!ok || rename(temp.c_str(), path_.c_str()) < 0) {
+      remove(temp.c_str());
+      return false;
+    }
+
+    valid_file_ = true;
+    file_records_ = records_.size();
+    return true;
+  }
+
+  std::string path_;
+  std::unordered_map<uint64_t, detail::history_record> records_;
+  std::vector<detail::history_record> pending_;
+  size_t file_records_ = 0;
+  bool valid_file_ = false;
+};
+
+// A comparison for run_options::order based on earlier runs. With
+// `failed_first`, tests that failed (or timed out) last time go first, which
+// gets feedback on a fix as soon as possible. With `longest_first`, the tests
+// expected to take the longest go first, so that a slow test doesn't get
+// started at the very end of a parallel run; tests we know nothing about are
+// assumed to be slow.
+class history_order {
+public:
+  history_order(const history_store &store, bool failed_first,
+                bool longest_first)
+    : store_(&store), failed_first_(failed_first),
+      longest_first_(longest_first), keys_(std::make_shared<key_map>()) {}
+
+  bool operator ()(const test_name &lhs, const test_name &rhs) const {
+    const auto &l = key(lhs), &r = key(rhs);
+    if(failed_first_ && l.failed != r.failed)
+      return l.failed;
+    return longest_first_ && l.expected > r.expected;
+  }
+private:
+  struct sort_key {
+    bool failed;
+    std::chrono::nanoseconds expected;
+  };
+  using key_map = std::unordered_map<size_t, sort_key>;
+
+  // Looking up a test means hashing its full name, so remember the result for
+  // the rest of the sort.
+  const sort_key & key(const test_name &test) const {
+    auto i = keys_->find(test.id);
+    if(i != keys_->end())
+      return i->second;
+
+    test_history history;
+    sort_key k = {false, std::chrono::nanoseconds::max()};
+    if(store_->find(test, history)) {
+      k.failed = history.last_outcome != test_outcome::passed;
+      k.expected = history.mean_duration;
+    }
+    return keys_->emplace(test.id, k).first->second;
+  }
+
+  const history_store *store_;
+  bool failed_first_, longest_first_;
+  std::shared_ptr<key_map> keys_;
+};
+
+// A cost function for test_shard that balances the shards by how long each test
+// took in earlier runs. Tests we know nothing about are assumed to take as long
+// as the average test.
+class history_cost {
+public:
+  explicit history_cost(const history_store &store)
+    : store_(&store), fallback_(store.mean_duration()) {}
+
+  std::chrono::nanoseconds operator ()(const test_name &test) const {
+    test_history history;
+    return store_->find(test, history) ? history.mean_duration : fallback_;
+  }
+private:
+  const history_store *store_;
+  std::chrono::nanoseconds fallback_;
+};
+
+// Records the result of every test that runs into a history_store.
+class history_logger : public test_logger {
+public:
+  history_logger(history_store &store) : store_(store) {}
+
+  void start_run() {}
+  void end_run() {}
+
+  void start_suite(const std::vector<std::string> &) {}
+  void end_suite(const std::vector<std::string> &) {}
+
+  void start_test(const test_name &) {}
+
+  void passed_test(const test_name &test, const test_metrics &metrics) {
+    store_.record(test, test_outcome::passed, metrics);
+  }
+
+  void skipped_test(const test_name &) {}
+
+  void failed_test(const test_name &test, const std::string &,
+                   const test_metrics &metrics) {
+    store_.record(test, test_outcome::failed, metrics);
+  }
+
+  void timed_out_test(const test_name &test,
+                      std::chrono::milliseconds elapsed) {
+    test_metrics metrics;
+    metrics.timing.test.wall = elapsed;
+    store_.record(test, test_outcome::timed_out, metrics);
+  }
+private:
+  history_store &store_;
+};
+
+} // namespace mettle
+
+#endif
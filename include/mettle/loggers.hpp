@@ -0,0 +1,686 @@
+#ifndef INC_METTLE_LOGGERS_HPP
+#define INC_METTLE_LOGGERS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "term.hpp"
+#include "runner.hpp"
+
+namespace mettle {
+
+namespace detail {
+  template<typename Rep, typename Period>
+  std::string format_duration(std::chrono::duration<Rep, Period> d) {
+    using namespace std::chrono;
+    auto ns = duration_cast<nanoseconds>(d).count();
+
+    std::stringstream s;
+    s << std::fixed << std::setprecision(ns < 1000 ? 0 : 1);
+    if(ns < 1000)
+      s << ns << " ns";
+    else if(ns < 1000000)
+      s << ns / 1e3 << " us";
+    else if(ns < 1000000000)
+      s << ns / 1e6 << " ms";
+    else
+      s << ns / 1e9 << " s";
+    return s.str();
+  }
+
+  inline std::string format_size(long kib) {
+    std::stringstream s;
+    s << std::fixed << std::setprecision(kib < 1024 ? 0 : 1);
+    if(kib < 1024)
+      s << kib << " KiB";
+    else if(kib < 1024 * 1024)
+      s << kib / 1024.0 << " MiB";
+    else
+      s << kib / (1024.0 * 1024) << " GiB";
+    return s.str();
+  }
+
+  inline std::string format_bytes(long bytes) {
+    if(bytes > -1024 && bytes < 1024)
+      return std::to_string(bytes) + " B";
+    return format_size(bytes / 1024);
+  }
+
+  // List whichever hardware counts are available, e.g. "1200 instructions,
+  // 400 cycles (3.00 IPC), 2 branch misses".
+  inline std::string format_counters(const hw_counters &counters) {
+    std::stringstream s;
+    s << std::fixed;
+    bool first = true;
+    auto count = [&s, &first](double value, const char *what) {
+      if(value < 0)
+        return;
+      if(!first)
+        s << ", ";
+      first = false;
+      s << std::setprecision(value < 100 ? 1 : 0) << value << " " << what;
+    };
+
+    count(counters.instructions, "instructions");
+    count(counters.cycles, "cycles");
+    if(counters.instructions >= 0 && counters.cycles > 0) {
+      s << " (" << std::setprecision(2)
+        << counters.instructions / counters.cycles << " IPC)";
+    }
+    count(counters.branch_misses, "branch misses");
+    count(counters.l1d_misses, "L1d misses");
+    count(counters.llc_misses, "LLC misses");
+    return s.str();
+  }
+
+  inline std::string format_bench(const bench_stats &stats) {
+    std::stringstream s;
+    s << "mean " << format_duration(stats.mean) << " +/- "
+      << format_duration(stats.stddev) << ", median "
+      << format_duration(stats.median) << ", min "
+      << format_duration(stats.min) << " (" << stats.samples << " x "
+      << stats.iterations << " iterations)";
+    if(stats.counters.available())
+      s << "; per iteration: " << format_counters(stats.counters);
+    return s.str();
+  }
+
+  inline std::string timeout_message(std::chrono::milliseconds elapsed) {
+    return "timed out after " + std::to_string(elapsed.count()) + " ms";
+  }
+
+  class verbose_logger {
+  public:
+    verbose_logger(std::ostream &out, unsigned int verbosity)
+      : out(out), verbosity_(verbosity), first_(true), base_indent_(0) {}
+
+    void start_run() {
+      first_ = true;
+      if(verbosity_ == 1)
+        out << std::string(base_indent_, ' ');
+    }
+
+    void end_run() {
+      if(verbosity_ == 1)
+        out << std::endl;
+    }
+
+    void start_suite(const std::vector<std::string> &suites) {
+      using namespace term;
+      if(verbosity_ >= 2) {
+        if(!first_)
+          out << std::endl;
+        first_ = false;
+
+        const std::string indent((suites.size() - 1) * 2 + base_indent_, ' ');
+        out << indent << format(sgr::bold) << suites.back() << reset()
+            << std::endl;
+      }
+    }
+
+    void end_suite(const std::vector<std::string> &) {}
+
+    void start_test(const test_name &test) {
+      if(verbosity_ >= 2) {
+        const std::string indent(test.suites.size() * 2 + base_indent_, ' ');
+        out << indent << test.test << " " << std::flush;
+      }
+    }
+
+    void passed_test(const test_name &, const test_metrics &metrics) {
+      using namespace term;
+      if(verbosity_ == 0) {
+        return;
+      }
+      else if(verbosity_ == 1) {
+        out << format(sgr::bold, fg(color::green)) << "." << reset()
+            << std::flush;
+      }
+      else {
+        out << format(sgr::bold, fg(color::green)) << "PASSED" << reset();
+        if(metrics.counters.available())
+          out << ": " << format_counters(metrics.counters);
+        out << std::endl;
+      }
+    }
+
+    void passed_bench(const test_name &test, const bench_stats &stats,
+                      const test_metrics &metrics) {
+      using namespace term;
+      if(verbosity_ < 2) {
+        passed_test(test, metrics);
+      }
+      else {
+        out << format(sgr::bold, fg(color::green)) << "PASSED" << reset()
+            << ": " << format_bench(stats) << std::endl;
+      }
+    }
+
+    void skipped_test(const test_name &) {
+      using namespace term;
+      if(verbosity_ == 0) {
+        return;
+      }
+      else if(verbosity_ == 1) {
+        out << format(sgr::bold, fg(color::blue)) << "_" << reset()
+            << std::flush;
+      }
+      else {
+        out << format(sgr::bold, fg(color::blue)) << "SKIPPED" << reset()
+            << std::endl;
+      }
+    }
+
+    void failed_test(const test_name &, const std::string &message,
+                     const test_metrics &) {
+      using namespace term;
+      if(verbosity_ == 0) {
+        return;
+      }
+      else if(verbosity_ == 1) {
+        out << format(sgr::bold, fg(color::red)) << "!" << reset()
+            << std::flush;
+      }
+      else {
+        out << format(sgr::bold, fg(color::red)) << "FAILED" << reset() << ": "
+            << message << std::endl;
+      }
+    }
+
+    void timed_out_test(const test_name &,
+                        std::chrono::milliseconds elapsed) {
+      using namespace term;
+      if(verbosity_ == 0) {
+        return;
+      }
+      else if(verbosity_ == 1) {
+        out << format(sgr::bold, fg(color::yellow)) << "T" << reset()
+            << std::flush;
+      }
+      else {
+        out << format(sgr::bold, fg(color::yellow)) << "TIMED OUT" << reset()
+            << ": " << timeout_message(elapsed) << std::endl;
+      }
+    }
+
+    unsigned int verbosity() const {
+      return verbosity_;
+    }
+
+    void indent(size_t n) {
+      base_indent_ = n;
+    }
+
+    std::ostream &out;
+  private:
+    unsigned int verbosity_;
+    bool first_;
+    size_t base_indent_;
+  };
+
+  class single_run_logger : public test_logger {
+  public:
+    // If `show_growth` is set, list the tests that left memory allocated
+    // behind them. This is worth knowing when tests share a process, since
+    // that memory piles up over the course of the run.
+    single_run_logger(verbose_logger vlog, size_t slowest = 0,
+                      size_t top_memory = 0, size_t top_cpu = 0,
+                      size_t top_allocations = 0, bool show_growth = false)
+      : vlog_(vlog), total_(0), passes_(0), skips_(0), slowest_(slowest),
+        top_memory_(top_memory), top_cpu_(top_cpu),
+        top_allocations_(top_allocations), show_growth_(show_growth) {}
+
+    void start_run() {
+      run_start_ = std::chrono::steady_clock::now();
+      vlog_.start_run();
+    }
+
+    void end_run() {
+      run_time_ = std::chrono::steady_clock::now() - run_start_;
+      vlog_.end_run();
+    }
+
+    void start_suite(const std::vector<std::string> &suites) {
+      vlog_.start_suite(suites);
+    }
+
+    void end_suite(const std::vector<std::string> &suites) {
+      vlog_.end_suite(suites);
+    }
+
+    void start_test(const test_name &test) {
+      total_++;
+      vlog_.start_test(test);
+    }
+
+    void passed_test(const test_name &test, const test_metrics &metrics) {
+      passes_++;
+      record_metrics(test, metrics);
+      vlog_.passed_test(test, metrics);
+    }
+
+    void passed_bench(const test_name &test, const bench_stats &stats,
+                      const test_metrics &metrics) {
+      passes_++;
+      record_metrics(test, metrics);
+      benches_.push_back({test, stats});
+      vlog_.passed_bench(test, stats, metrics);
+    }
+
+    void skipped_test(const test_name &test) {
+      skips_++;
+      vlog_.skipped_test(test);
+    }
+
+    void failed_test(const test_name &test, const std::string &message,
+                     const test_metrics &metrics) {
+      failures_.push_back({test, message, false});
+      record_metrics(test, metrics);
+      vlog_.failed_test(test, message, metrics);
+    }
+
+    void timed_out_test(const test_name &test,
+                        std::chrono::milliseconds elapsed) {
+      failures_.push_back({test, timeout_message(elapsed), true});
+      vlog_.timed_out_test(test, elapsed);
+    }
+
+    void summarize() {
+      using namespace term;
+
+      if(vlog_.verbosity())
+        vlog_.out << std::endl;
+
+      vlog_.out << format(sgr::bold) << passes_ << "/" << total_
+                << " tests passed";
+      if(skips_)
+        vlog_.out << " (" << skips_ << " skipped)";
+      vlog_.out << reset() << std::endl;
+
+      for(const auto &i : failures_) {
+        vlog_.out << "  " << i.test.full_name() << " ";
+        if(i.timed_out) {
+          vlog_.out << format(sgr::bold, fg(color::yellow)) << "TIMED OUT";
+        }
+        else {
+          vlog_.out << format(sgr::bold, fg(color::red)) << "FAILED";
+        }
+        vlog_.out << reset() << ": " << i.message << std::endl;
+      }
+
+      if(!benches_.empty())
+        summarize_benches();
+      if(slowest_)
+        summarize_timings();
+      if(top_memory_)
+        summarize_memory();
+      if(top_cpu_)
+        summarize_cpu();
+      if(top_allocations_)
+        summarize_allocations();
+      if(show_growth_)
+        summarize_growth();
+    }
+
+    size_t failures() const {
+      return failures_.size();
+    }
+  private:
+    struct failure {
+      test_name test;
+      std::string message;
+      bool timed_out;
+    };
+
+    struct record {
+      test_name test;
+      test_metrics metrics;
+    };
+
+    struct bench_record {
+      test_name test;
+      bench_stats stats;
+    };
+
+    void record_metrics(const test_name &test, const test_metrics &m) {
+      if(slowest_ || top_memory_ || top_cpu_ || top_allocations_ ||
+         (show_growth_ && m.allocations.net_bytes > 0))
+        records_.push_back({test, m});
+    }
+
+    static std::chrono::nanoseconds cpu_time(const test_usage &u) {
+      return u.user + u.system;
+    }
+
+    void summarize_timings() {
+      using namespace term;
+      using std::chrono::nanoseconds;
+
+      std::sort(records_.begin(), records_.end(), [](const auto &a,
+                                                     const auto &b) {
+        return a.metrics.timing.total().wall > b.metrics.timing.total().wall;
+      });
+
+      vlog_.out << std::endl << format(sgr::bold) << "Slowest tests"
+                << reset() << std::endl;
+      for(size_t i = 0; i != std::min(slowest_, records_.size()); i++) {
+        const auto &t = records_[i].metrics.timing;
+        vlog_.out << "  " << std::setw(10) << format_duration(t.total().wall)
+                  << "  " << records_[i].test.full_name() << " (setup "
+                  << format_duration(t.setup.wall) << ", test "
+                  << format_duration(t.test.wall) << ", teardown "
+                  << format_duration(t.teardown.wall) << ")" << std::endl;
+      }
+
+      auto seconds = std::chrono::duration<double>(run_time_).count();
+      vlog_.out << std::endl << records_.size() << " tests in "
+                << format_duration(run_time_);
+      if(seconds > 0) {
+        vlog_.out << " (" << std::fixed << std::setprecision(1)
+                  << records_.size() / seconds << " tests/s)";
+        vlog_.out.unsetf(std::ios_base::floatfield);
+      }
+      vlog_.out << std::endl;
+
+      if(records_.empty())
+        return;
+
+      // records_ is sorted from slowest to fastest, so the pth percentile is
+      // (100 - p)% of the way in.
+      auto percentile = [this](double p) {
+        size_t i = static_cast<size_t>((1 - p / 100) * (records_.size() - 1));
+        return records_[i].metrics.timing.total().wall;
+      };
+      vlog_.out << "  p50 " << format_duration(percentile(50))
+                << ", p90 " << format_duration(percentile(90))
+                << ", p99 " << format_duration(percentile(99))
+                << ", max " << format_duration(percentile(100)) << std::endl;
+    }
+
+    void summarize_memory() {
+      using namespace term;
+
+      std::stable_sort(records_.begin(), records_.end(), [](const auto &a,
+                                                            const auto &b) {
+        return a.metrics.usage.max_rss > b.metrics.usage.max_rss;
+      });
+
+      vlog_.out << std::endl << format(sgr::bold) << "Most memory" << reset()
+                << std::endl;
+      for(size_t i = 0; i != std::min(top_memory_, records_.size()); i++) {
+        const auto &u = records_[i].metrics.usage;
+        vlog_.out << "  " << std::setw(10) << format_size(u.max_rss) << "  "
+                  << records_[i].test.full_name() << " (" << u.minor_faults
+                  << " minor faults, " << u.major_faults << " major faults, "
+                  << u.block_inputs << " blocks in, " << u.block_outputs
+                  << " blocks out)" << std::endl;
+      }
+    }
+
+    void summarize_cpu() {
+      using namespace term;
+
+      std::stable_sort(records_.begin(), records_.end(), [](const auto &a,
+                                                            const auto &b) {
+        return cpu_time(a.metrics.usage) > cpu_time(b.metrics.usage);
+      });
+
+      vlog_.out << std::endl << format(sgr::bold) << "Most CPU time" << reset()
+                << std::endl;
+      for(size_t i = 0; i != std::min(top_cpu_, records_.size()); i++) {
+        const auto &u = records_[i].metrics.usage;
+        vlog_.out << "  " << std::setw(10) << format_duration(cpu_time(u))
+                  << "  " << records_[i].test.full_name() << " (user "
+                  << format_duration(u.user) << ", system "
+                  << format_duration(u.system) << ", "
+                  << u.voluntary_switches + u.involuntary_switches
+                  << " context switches)" << std::endl;
+      }
+    }
+
+    void summarize_benches() {
+      using namespace term;
+
+      vlog_.out << std::endl << format(sgr::bold) << "Benchmarks" << reset()
+                << std::endl;
+      for(const auto &i : benches_) {
+        vlog_.out << "  " << std::setw(10) << format_duration(i.stats.mean)
+                  << "  " << i.test.full_name() << " (+/- "
+                  << format_duration(i.stats.stddev) << ", median "
+                  << format_duration(i.stats.median) << ", min "
+                  << format_duration(i.stats.min);
+        if(i.stats.counters.available())
+          vlog_.out << ", " << format_counters(i.stats.counters);
+        vlog_.out << ")" << std::endl;
+      }
+    }
+
+    void summarize_allocations() {
+      using namespace term;
+
+      std::stable_sort(records_.begin(), records_.end(), [](const auto &a,
+                                                            const auto &b) {
+        return a.metrics.allocations.bytes > b.metrics.allocations.bytes;
+      });
+
+      vlog_.out << std::endl << format(sgr::bold) << "Most allocated"
+                << reset() << std::endl;
+      for(size_t i = 0; i != std::min(top_allocations_, records_.size());
+          i++) {
+        const auto &a = records_[i].metrics.allocations;
+        vlog_.out << "  " << std::setw(10) << format_bytes(a.bytes) << "  "
+                  << records_[i].test.full_name() << " (" << a.count
+                  << " allocations, " << a.frees << " frees, "
+                  << format_bytes(a.net_bytes) << " left behind)"
+                  << std::endl;
+      }
+    }
+
+    void summarize_growth() {
+      using namespace term;
+
+      std::vector<const record *> grew;
+      for(const auto &i : records_) {
+        if(i.metrics.allocations.net_bytes > 0)
+          grew.push_back(&i);
+      }
+      if(grew.empty())
+        return;
+
+      std::stable_sort(grew.begin(), grew.end(), [](const auto *a,
+                                                    const auto *b) {
+        return a->metrics.allocations.net_bytes >
+               b->metrics.allocations.net_bytes;
+      });
+
+      vlog_.out << std::endl << format(sgr::bold, fg(color::yellow))
+                << "Tests that left memory behind" << reset() << std::endl;
+      for(const auto *i : grew) {
+        const auto &a = i->metrics.allocations;
+        vlog_.out << "  " << std::setw(10) << format_bytes(a.net_bytes)
+                  << "  " << i->test.full_name() << " (" << a.count - a.frees
+                  << " more allocations than frees)" << std::endl;
+      }
+    }
+
+    verbose_logger vlog_;
+    size_t total_, passes_, skips_;
+    std::vector<const failure> failures_;
+
+    size_t slowest_, top_memory_, top_cpu_, top_allocations_;
+    bool show_growth_;
+    std::vector<record> records_;
+    std::vector<bench_record> benches_;
+    std::chrono::steady_clock::time_point run_start_;
+    std::chrono::steady_clock::duration run_time_;
+  };
+
+  class multi_run_logger : public test_logger {
+  public:
+    // If `show_growth` is set, list the tests that left memory allocated
+    // behind them on every run. As with single_run_logger, this only means
+    // anything when tests share a process.
+    multi_run_logger(verbose_logger vlog, bool show_growth = false)
+      : vlog_(vlog), total_(0), skips_(0), runs_(0),
+        show_growth_(show_growth) {
+      if(vlog_.verbosity() == 2)
+        vlog_.indent(2);
+    }
+
+    void start_run() {
+      using namespace term;
+      runs_++;
+      total_ = skips_ = 0;
+
+      if(vlog_.verbosity() == 2) {
+        if(runs_ > 1)
+          vlog_.out << std::endl;
+        vlog_.out << format(sgr::bold) << "Test run" << reset() << " "
+                  << format(sgr::bold, fg(color::yellow)) << "[#" << runs_
+                  << "]" << reset() << std::endl << std::endl;
+      }
+      vlog_.start_run();
+    }
+
+    void end_run() {
+      vlog_.end_run();
+    }
+
+    void start_suite(const std::vector<std::string> &suites) {
+      vlog_.start_suite(suites);
+    }
+
+    void end_suite(const std::vector<std::string> &suites) {
+      vlog_.end_suite(suites);
+    }
+
+    void start_test(const test_name &test) {
+      total_++;
+      vlog_.start_test(test);
+    }
+
+    void passed_test(const test_name &test, const test_metrics &metrics) {
+      record_growth(test, metrics);
+      vlog_.passed_test(test, metrics);
+    }
+
+    void passed_bench(const test_name &test, const bench_stats &stats,
+                      const test_metrics &metrics) {
+      record_growth(test, metrics);
+      vlog_.passed_bench(test, stats, metrics);
+    }
+
+    void skipped_test(const test_name &test) {
+      skips_++;
+      vlog_.skipped_test(test);
+    }
+
+    void failed_test(const test_name &test, const std::string &message,
+                     const test_metrics &metrics) {
+      failures_[test].push_back({runs_, message});
+      record_growth(test, metrics);
+      vlog_.failed_test(test, message, metrics);
+    }
+
+    void timed_out_test(const test_name &test,
+                        std::chrono::milliseconds elapsed) {
+      failures_[test].push_back({runs_, timeout_message(elapsed)});
+      vlog_.timed_out_test(test, elapsed);
+    }
+
+    void summarize() {
+      using namespace term;
+      size_t passes = total_ - skips_ - failures_.size();
+
+      if(vlog_.verbosity())
+        vlog_.out << std::endl;
+
+      vlog_.out << format(sgr::bold) << passes << "/" << total_
+                << " tests passed";
+      if(skips_)
+        vlog_.out << " (" << skips_ << " skipped)";
+      vlog_.out << reset() << std::endl;
+
+      int run_width = std::ceil(std::log10(runs_));
+      for(const auto &i : failures_) {
+        format fail_count_fmt(
+          sgr::bold, fg(i.second.size() == runs_ ? color::red : color::yellow)
+        );
+        vlog_.out << "  " << i.first.full_name() << " "
+                  << format(sgr::bold, fg(color::red)) << "FAILED" << reset()
+                  << " " << fail_count_fmt << "[" << i.second.size() << "/"
+                  << runs_ << "]" << reset() << ":" << std::endl;
+
+        for(const auto &j : i.second) {
+          vlog_.out << "    " << j.message << " "
+                    << format(sgr::bold, fg(color::yellow)) << "["
+                    << std::setw(run_width) << j.run << "]" << reset()
+                    << std::endl;
+        }
+      }
+
+      summarize_growth();
+    }
+
+    size_t failures() const {
+      return failures_.size();
+    }
+  private:
+    struct failure {
+      size_t run;
+      std::string message;
+    };
+
+    struct growth {
+      size_t runs = 0;
+      long bytes = 0;
+    };
+
+    void record_growth(const test_name &test, const test_metrics &metrics) {
+      if(show_growth_ && metrics.allocations.net_bytes > 0) {
+        auto &g = growth_[test];
+        g.runs++;
+        g.bytes += metrics.allocations.net_bytes;
+      }
+    }
+
+    // A test that leaves memory behind only once is probably just filling a
+    // cache on its first run; one that does it every run will keep growing
+    // for as long as we keep running it.
+    void summarize_growth() {
+      using namespace term;
+
+      bool first = true;
+      for(const auto &i : growth_) {
+        if(i.second.runs != runs_)
+          continue;
+        if(first) {
+          vlog_.out << std::endl << format(sgr::bold, fg(color::yellow))
+                    << "Tests that left memory behind on every run" << reset()
+                    << std::endl;
+          first = false;
+        }
+        vlog_.out << "  " << std::setw(10)
+                  << format_bytes(i.second.bytes / static_cast<long>(runs_))
+                  << "  " << i.first.full_name() << " (per run)" << std::endl;
+      }
+    }
+
+    verbose_logger vlog_;
+    size_t total_, skips_, runs_;
+    bool show_growth_;
+    std::map<test_name, std::vector<const failure>> failures_;
+    std::map<test_name, growth> growth_;
+  };
+}
+
+} // namespace mettle
+
+#endif
@@ -3,10 +3,17 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
 #include <limits>
+#include <sstream>
+#include <type_traits>
 
 #include "core.hpp"
+#include "collection.hpp"
 
 namespace mettle {
 
@@ -42,6 +49,344 @@ auto near_to_abs(T &&expected, const T &tolerance) {
   );
 }
 
+namespace detail {
+  template<typename T>
+  struct ulp_integer;
+
+  template<>
+  struct ulp_integer<float> {
+    using type = int32_t;
+  };
+
+  template<>
+  struct ulp_integer<double> {
+    using type = int64_t;
+  };
+
+  // How many representable values apart `a` and `b` are. NaNs are as far from
+  // everything as possible.
+  template<typename T>
+  inline uint64_t ulp_distance(T a, T b) {
+    using I = typename ulp_integer<T>::type;
+    if(std::isnan(a) || std::isnan(b))
+      return std::numeric_limits<uint64_t>::max();
+
+    I x, y;
+    std::memcpy(&x, &a, sizeof(T));
+    std::memcpy(&y, &b, sizeof(T));
+    // Flip negative values around so that the integers are ordered the same
+    // way as the floating-point values they came from.
+    if(x < 0)
+      x = std::numeric_limits<I>::min() - x;
+    if(y < 0)
+      y = std::numeric_limits<I>::min() - y;
+    return x > y ? static_cast<uint64_t>(x) - static_cast<uint64_t>(y) :
+                   static_cast<uint64_t>(y) - static_cast<uint64_t>(x);
+  }
+
+  // The range a range matcher compares against, looking through any
+  // `std::reference_wrapper`.
+  template<typename T>
+  struct unwrap_range {
+    using type = T;
+  };
+
+  template<typename T>
+  struct unwrap_range<std::reference_wrapper<T>> {
+    using type = T;
+  };
+
+  template<typename T>
+  using unwrap_range_t = typename unwrap_range<
+    std::remove_cv_t<std::remove_reference_t<T>>
+  >::type;
+
+  template<typename T>
+  using range_value_t = std::remove_cv_t<std::remove_reference_t<
+    decltype(*std::begin(std::declval<unwrap_range_t<T>&>()))
+  >>;
+
+  // The tolerances for comparing ranges. Each one checks whether a pair of
+  // elements is close enough, and measures how far apart they are.
+  template<typename T>
+  struct relative_tolerance {
+    template<typename U>
+    bool operator ()(U actual, U expected) const {
+      auto mag = std::max<U>(std::abs(expected), std::abs(actual));
+      return std::abs(actual - expected) <= mag * epsilon;
+    }
+
+    template<typename U>
+    double error(U actual, U expected) const {
+      auto mag = std::max<U>(std::abs(expected), std::abs(actual));
+      return mag == 0 ? 0 : std::abs(actual - expected) / mag;
+    }
+
+    std::string desc() const {
+      std::stringstream s;
+      s << "relative error <= " << epsilon;
+      return s.str();
+    }
+
+    T epsilon;
+  };
+
+  template<typename T>
+  struct absolute_tolerance {
+    template<typename U>
+    bool operator ()(U actual, U expected) const {
+      return std::abs(actual - expected) <= tolerance;
+    }
+
+    template<typename U>
+    double error(U actual, U expected) const {
+      return std::abs(actual - expected);
+    }
+
+    std::string desc() const {
+      std::stringstream s;
+      s << "absolute error <= " << tolerance;
+      return s.str();
+    }
+
+    T tolerance;
+  };
+
+  struct ulp_tolerance {
+    template<typename U>
+    bool operator ()(U actual, U expected) const {
+      return ulp_distance(actual, expected) <= ulps;
+    }
+
+    template<typename U>
+    double error(U actual, U expected) const {
+      return ulp_distance(actual, expected);
+    }
+
+    std::string desc() const {
+      return "within " + std::to_string(ulps) + " ULPs";
+    }
+
+    uint64_t ulps;
+  };
+
+  // Which elements of a range didn't match, summarized so that huge ranges
+  // produce a short message.
+  template<typename T>
+  class mismatch_summary {
+  public:
+    void add(size_t index, T actual, T expected, double error) {
+      if(count_++ == 0) {
+        first_ = {index, actual, expected, error};
+        worst_ = first_;
+      }
+      else if(error > worst_.error ||
+              (std::isnan(error) && !std::isnan(worst_.error))) {
+        worst_ = {index, actual, expected, error};
+      }
+    }
+
+    size_t count() const {
+      return count_;
+    }
+
+    std::string message(size_t size) const {
+      std::stringstream s;
+      s << count_ << " of " << size << " elements differ; first at index "
+        << first_.index << ": " << ensure_printable(first_.actual) << " vs "
+        << ensure_printable(first_.expected) << "; worst at index "
+        << worst_.index << ": " << ensure_printable(worst_.actual) << " vs "
+        << ensure_printable(worst_.expected) << " (error " << worst_.error
+        << ")";
+      return s.str();
+    }
+  private:
+    struct mismatch {
+      size_t index;
+      T actual, expected;
+      double error;
+    };
+
+    size_t count_ = 0;
+    mismatch first_, worst_;
+  };
+
+  inline std::string size_mismatch(size_t actual, size_t expected) {
+    return std::to_string(actual) + " elements instead of " +
+           std::to_string(expected);
+  }
+
+  template<typename T>
+  class range_capture {
+  public:
+    range_capture(const T &t) : capture_(t) {}
+    range_capture(T &&t) : capture_(std::move(t)) {}
+
+    const T & value() const {
+      return capture_.value;
+    }
+  private:
+    any_capture<T> capture_;
+  };
+
+  // Ranges passed via `std::ref` are referred to in place instead of copied,
+  // so the range has to outlive the matcher.
+  template<typename T>
+  class range_capture<std::reference_wrapper<T>> {
+  public:
+    range_capture(std::reference_wrapper<T> t) : ref_(t.get()) {}
+
+    const T & value() const {
+      return ref_;
+    }
+  private:
+    const T &ref_;
+  };
+
+  template<typename T, typename Tolerance>
+  class elements_near_impl : public matcher_tag {
+  public:
+    template<typename T2>
+    elements_near_impl(T2 &&expected, Tolerance tolerance)
+      : expected_(std::forward<T2>(expected)), tolerance_(tolerance) {}
+
+    template<typename U>
+    match_result operator ()(const U &actual) const {
+      return match(actual, std::integral_constant<bool,
+        contiguous_range<U>::value && contiguous_range<expected_type>::value
+      >());
+    }
+
+    std::string desc() const {
+      std::stringstream s;
+      s << "~= " << std::distance(std::begin(expected_.value()),
+                                  std::end(expected_.value()))
+        << " expected elements (" << tolerance_.desc() << ")";
+      return s.str();
+    }
+  private:
+    using expected_type = std::remove_cv_t<unwrap_range_t<T>>;
+
+    template<typename U>
+    using value_type = std::common_type_t<
+      range_value_t<const U>, range_value_t<const expected_type>
+    >;
+
+    // Both ranges are contiguous, so check them a block at a time and only
+    // look closer at the blocks with any mismatches.
+    template<typename U>
+    match_result match(const U &actual, std::true_type) const {
+      using V = value_type<U>;
+      const auto *a = contiguous_range<U>::data(actual);
+      const auto *e = contiguous_range<expected_type>::data(expected_.value());
+      size_t size = contiguous_range<U>::size(actual);
+      size_t expected_size = contiguous_range<expected_type>::size(
+        expected_.value()
+      );
+      if(size != expected_size)
+        return { false, size_mismatch(size, expected_size) };
+
+      mismatch_summary<V> summary;
+      const auto &near = tolerance_;
+      auto differs = [a, e, &near](size_t i) {
+        return !near(static_cast<V>(a[i]), static_cast<V>(e[i]));
+      };
+      for(size_t i = 0; (i = find_first(i, size, differs)) != size; i++) {
+        V x = a[i], y = e[i];
+        summary.add(i, x, y, near.error(x, y));
+      }
+      if(summary.count())
+        return { false, summary.message(size) };
+      return true;
+    }
+
+    template<typename U>
+    match_result match(const U &actual, std::false_type) const {
+      using V = value_type<U>;
+      mismatch_summary<V> summary;
+      auto a = std::begin(actual), a_end = std::end(actual);
+      auto e = std::begin(expected_.value()),
+           e_end = std::end(expected_.value());
+      size_t i = 0;
+      for(; a != a_end && e != e_end; ++a, ++e, ++i) {
+        V x = *a, y = *e;
+        if(!tolerance_(x, y))
+          summary.add(i, x, y, tolerance_.error(x, y));
+      }
+
+      if(a != a_end || e != e_end) {
+        return { false, size_mismatch(i + std::distance(a, a_end),
+                                      i + std::distance(e, e_end)) };
+      }
+      if(summary.count())
+        return { false, summary.message(i) };
+      return true;
+    }
+
+    range_capture<T> expected_;
+    Tolerance tolerance_;
+  };
+
+  template<typename T, typename Tolerance>
+  inline auto make_elements_near(T &&expected, Tolerance tolerance) {
+    return elements_near_impl<
+      std::remove_cv_t<std::remove_reference_t<T>>, Tolerance
+    >(
+      std::forward<T>(expected), tolerance
+    );
+  }
+}
+
+template<typename T>
+auto near_to_ulp(T &&expected, uint64_t ulps) {
+  return make_matcher(
+    std::forward<T>(expected),
+    [ulps](const auto &actual, const auto &expected) -> bool {
+      using V = std::common_type_t<std::decay_t<decltype(actual)>,
+                                   std::decay_t<decltype(expected)>>;
+      return detail::ulp_distance<V>(actual, expected) <= ulps;
+    }, "~= "
+  );
+}
+
+// Range versions of the above: each element of the actual range must be near
+// the corresponding element of `expected`, and the ranges must be the same
+// size. Contiguous ranges of numbers (e.g. `std::vector<float>`) are compared
+// a block at a time, which the compiler can vectorize. Like other matchers,
+// these copy `expected`; pass `std::ref(expected)` to refer to it instead.
+
+template<typename T>
+auto elements_near_to(T &&expected,
+                      const detail::range_value_t<T> &epsilon) {
+  using V = detail::range_value_t<T>;
+  return detail::make_elements_near(
+    std::forward<T>(expected), detail::relative_tolerance<V>{epsilon}
+  );
+}
+
+template<typename T>
+auto elements_near_to(T &&expected) {
+  using V = detail::range_value_t<T>;
+  return elements_near_to(std::forward<T>(expected),
+                          std::numeric_limits<V>::epsilon() * 10);
+}
+
+template<typename T>
+auto elements_near_to_abs(T &&expected,
+                          const detail::range_value_t<T> &tolerance) {
+  using V = detail::range_value_t<T>;
+  return detail::make_elements_near(
+    std::forward<T>(expected), detail::absolute_tolerance<V>{tolerance}
+  );
+}
+
+template<typename T>
+auto elements_near_to_ulp(T &&expected, uint64_t ulps) {
+  return detail::make_elements_near(
+    std::forward<T>(expected), detail::ulp_tolerance{ulps}
+  );
+}
+
 } // namespace mettle
 
 #endif
@@ -2,22 +2,160 @@
 #define INC_METTLE_MATCHERS_ARRAY_HPP
 
 #include <algorithm>
+#include <array>
+#include <sstream>
 #include <tuple>
+#include <type_traits>
+#include <vector>
 
 #include "core.hpp"
+#include "relational.hpp"
 
 namespace mettle {
 
+namespace detail {
+  // Ranges whose elements are stored contiguously in memory.
+  template<typename T>
+  struct contiguous_range : std::false_type {};
+
+  template<typename T, typename Alloc>
+  struct contiguous_range<std::vector<T, Alloc>> : std::true_type {
+    using value_type = T;
+    static const T * data(const std::vector<T, Alloc> &v) { return v.data(); }
+    static size_t size(const std::vector<T, Alloc> &v) { return v.size(); }
+  };
+
+  template<typename Alloc>
+  struct contiguous_range<std::vector<bool, Alloc>> : std::false_type {};
+
+  template<typename T, size_t N>
+  struct contiguous_range<std::array<T, N>> : std::true_type {
+    using value_type = T;
+    static const T * data(const std::array<T, N> &a) { return a.data(); }
+    static size_t size(const std::array<T, N> &) { return N; }
+  };
+
+  template<typename T, size_t N>
+  struct contiguous_range<T[N]> : std::true_type {
+    using value_type = T;
+    static const T * data(const T (&a)[N]) { return a; }
+    static size_t size(const T (&)[N]) { return N; }
+  };
+
+  template<typename Range, typename Matcher, typename = void>
+  struct is_fast_range_match : std::false_type {};
+
+  // A contiguous range of numbers checked against a relational matcher (e.g.
+  // `each(less(10))`) can be checked without calling the matcher for every
+  // element.
+  template<typename Range, typename T, typename F, typename D>
+  struct is_fast_range_match<
+    Range, basic_matcher<T, F, D>,
+    typename std::enable_if<contiguous_range<Range>::value>::type
+  > : std::integral_constant<bool,
+    std::is_arithmetic<typename contiguous_range<Range>::value_type>::value &&
+    std::is_arithmetic<T>::value && is_relational<F>::value
+  > {};
+
+  // Find the first index in [begin, end) where `pred` is true, returning `end`
+  // if there isn't one. The indices are checked in blocks, with no branches
+  // inside each block so that the compiler can vectorize it; only the block
+  // holding the match is searched one index at a time.
+  template<typename Pred>
+  size_t find_first(size_t begin, size_t end, const Pred &pred) {
+    const size_t block = 64;
+    size_t i = begin;
+    for(; i + block <= end; i += block) {
+      // Compilers are better at vectorizing this with an integer than a bool.
+      unsigned found = 0;
+      for(size_t j = 0; j != block; j++)
+        found |= pred(i + j);
+      if(found)
+        break;
+    }
+    for(; i != end; i++) {
+      if(pred(i))
+        return i;
+    }
+    return end;
+  }
+
+  template<typename Index, typename T>
+  std::string first_mismatch(Index index, const T &value,
+                             const std::string &why = "") {
+    std::stringstream s;
+    s << "first mismatch at index " << index << ": "
+      << ensure_printable(value);
+    if(!why.empty())
+      s << " (" << why << ")";
+    return s.str();
+  }
+
+  template<typename Range, typename Matcher>
+  bool match_member(const Range &range, const Matcher &matcher,
+                    std::false_type) {
+    for(const auto &i : range) {
+      if(matcher(i))
+        return true;
+    }
+    return false;
+  }
+
+  template<typename Range, typename Matcher>
+  bool match_member(const Range &range, const Matcher &matcher,
+                    std::true_type) {
+    using traits = contiguous_range<Range>;
+    const auto *data = traits::data(range);
+    const auto &expected = matcher.capture();
+    const auto &f = matcher.function();
+    size_t size = traits::size(range);
+    return find_first(0, size, [&](size_t i) {
+      return f(data[i], expected);
+    }) != size;
+  }
+
+  template<typename Range, typename Matcher>
+  match_result match_each(const Range &range, const Matcher &matcher,
+                          std::false_type) {
+    size_t index = 0;
+    for(const auto &i : range) {
+      match_result result = matcher(i);
+      if(!result)
+        return { false, first_mismatch(index, i, result.message) };
+      index++;
+    }
+    return true;
+  }
+
+  template<typename Range, typename Matcher>
+  match_result match_each(const Range &range, const Matcher &matcher,
+                          std::true_type) {
+    using traits = contiguous_range<Range>;
+    const auto *data = traits::data(range);
+    const auto &expected = matcher.capture();
+    const auto &f = matcher.function();
+    size_t size = traits::size(range);
+    size_t index = find_first(0, size, [&](size_t i) {
+      return !f(data[i], expected);
+    });
+    if(index == size)
+      return true;
+    return { false, first_mismatch(index, data[index]) };
+  }
+}
+
 template<typename T>
 auto member(T &&thing) {
   return make_matcher(
     ensure_matcher(std::forward<T>(thing)),
     [](const auto &value, auto &&matcher) -> bool {
-      for(const auto &i : value) {
-        if(matcher(i))
-          return true;
-      }
-      return false;
+      using Range = std::remove_cv_t<std::remove_reference_t<decltype(value)>>;
+      using Matcher = std::remove_cv_t<
+        std::remove_reference_t<decltype(matcher)>
+      >;
+      return detail::match_member(
+        value, matcher, detail::is_fast_range_match<Range, Matcher>()
+      );
     }, "member "
   );
 }
@@ -26,16 +164,124 @@ template<typename T>
 auto each(T &&thing) {
   return make_matcher(
     ensure_matcher(std::forward<T>(thing)),
-    [](const auto &value, auto &&matcher) -> bool {
-      for(const auto &i : value) {
-        if(!matcher(i))
-          return false;
-      }
-      return true;
+    [](const auto &value, auto &&matcher) -> match_result {
+      using Range = std::remove_cv_t<std::remove_reference_t<decltype(value)>>;
+      using Matcher = std::remove_cv_t<
+        std::remove_reference_t<decltype(matcher)>
+      >;
+      return detail::match_each(
+        value, matcher, detail::is_fast_range_match<Range, Matcher>()
+      );
     }, "each "
   );
 }
 
+namespace detail {
+  // The elements that failed an expect_each(): how many there were, and a
+  // description of the first few.
+  class each_failures {
+  public:
+    explicit each_failures(size_t shown) : shown_(shown) {}
+
+    bool full() const {
+      return count_ >= shown_;
+    }
+
+    size_t count() const {
+      return count_;
+    }
+
+    template<typename T>
+    void add(size_t index, const T &value, const std::string &why = "") {
+      if(!full()) {
+        if(count_)
+          s_ << "; ";
+        s_ << "index " << index << ": " << ensure_printable(value);
+        if(!why.empty())
+          s_ << " (" << why << ")";
+      }
+      count_++;
+    }
+
+    // Count failures that we won't show.
+    void skip(size_t count) {
+      count_ += count;
+    }
+
+    std::string str() const {
+      std::stringstream s;
+      s << s_.str();
+      if(count_ > shown_) {
+        if(shown_)
+          s << "; ";
+        s << "... " << count_ - shown_ << " more";
+      }
+      return s.str();
+    }
+  private:
+    size_t shown_, count_ = 0;
+    std::stringstream s_;
+  };
+
+  template<typename Range, typename Matcher>
+  size_t check_each(const Range &range, const Matcher &matcher,
+                    each_failures &failures, std::false_type) {
+    size_t index = 0;
+    for(const auto &i : range) {
+      match_result result = matcher(i);
+      if(!result)
+        failures.add(index, i, result.message);
+      index++;
+    }
+    return index;
+  }
+
+  template<typename Range, typename Matcher>
+  size_t check_each(const Range &range, const Matcher &matcher,
+                    each_failures &failures, std::true_type) {
+    using traits = contiguous_range<Range>;
+    const auto *data = traits::data(range);
+    const auto &expected = matcher.capture();
+    const auto &f = matcher.function();
+    size_t size = traits::size(range);
+    auto mismatch = [&](size_t i) -> bool {
+      return !f(data[i], expected);
+    };
+
+    size_t i = 0;
+    while(!failures.full() && (i = find_first(i, size, mismatch)) != size) {
+      failures.add(i, data[i]);
+      i++;
+    }
+
+    // Once we've seen enough to show, just count the rest.
+    size_t rest = 0;
+    for(; i < size; i++)
+      rest += mismatch(i);
+    failures.skip(rest);
+    return size;
+  }
+}
+
+// Check every element of `range` against `matcher`, and if any fail, throw a
+// single expectation_error saying how many did and showing the first `shown`
+// of them. Unlike calling expect() in a loop, this always checks the whole
+// range.
+template<typename T, typename Matcher>
+void expect_each(const T &range, const Matcher &matcher, size_t shown = 10) {
+  detail::each_failures failures(shown);
+  size_t size = detail::check_each(
+    range, matcher, failures, detail::is_fast_range_match<T, Matcher>()
+  );
+  if(failures.count()) {
+    std::stringstream s;
+    s << "expected each " << matcher.desc() << ", but " << failures.count()
+      << " of " << size << " elements didn't match (" << failures.str()
+      << ")";
+    throw expectation_error(s.str());
+  }
+}
+
 namespace detail {
   template<typename ...T>
   class array_impl : public matcher_tag {
@@ -94,7 +340,7 @@ template<typename T>
 auto sorted(const T &comparator) {
   return make_matcher([comparator](const auto &value) {
     return std::is_sorted(std::begin(value), std::end(value), comparator);
-  }, "sorted by " + type_name<T>());
+  }, []() { return "sorted by " + type_name<T>(); });
 }
 
 } // namespace mettle
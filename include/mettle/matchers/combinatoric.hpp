@@ -1,7 +1,6 @@
 #ifndef INC_METTLE_MATCHERS_COMBINATORIC_HPP
 #define INC_METTLE_MATCHERS_COMBINATORIC_HPP
 
-#include <functional>
 #include <tuple>
 
 #include "core.hpp"
@@ -12,11 +11,11 @@ namespace detail {
   template<typename ...T>
   class reduce_impl : public matcher_tag {
   public:
-    using reducer_type = std::function<bool(bool, bool)>;
+    using reducer_type = bool (*)(bool, bool);
     using tuple_type = std::tuple<typename ensure_matcher_type<T>::type...>;
 
-    reduce_impl(const std::string &desc, const reducer_type &reducer,
-                bool initial, T &&...matchers)
+    reduce_impl(const char *desc, reducer_type reducer, bool initial,
+                T &&...matchers)
       : desc_(desc), reducer_(reducer), initial_(initial),
         matchers_(ensure_matcher(std::forward<T>(matchers))...) {}
 
@@ -45,7 +44,7 @@ namespace detail {
       return s.str();
     }
   private:
-    std::string desc_;
+    const char *desc_;
     reducer_type reducer_;
     bool initial_;
     tuple_type matchers_;
@@ -59,14 +58,16 @@ namespace detail {
 template<typename ...T>
 inline auto any(T &&...matchers) {
   return detail::reduce_impl<T...>(
-    "any of", std::logical_or<bool>(), false, std::forward<T>(matchers)...
+    "any of", [](bool a, bool b) { return a || b; }, false,
+    std::forward<T>(matchers)...
   );
 }
 
 template<typename ...T>
 inline auto all(T &&...matchers) {
   return detail::reduce_impl<T...>(
-    "all of", std::logical_and<bool>(), true, std::forward<T>(matchers)...
+    "all of", [](bool a, bool b) { return a && b; }, true,
+    std::forward<T>(matchers)...
   );
 }
 
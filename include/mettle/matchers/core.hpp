@@ -21,6 +21,22 @@ struct is_matcher : public std::is_base_of<
   matcher_tag, typename std::remove_reference<T>::type
 > {};
 
+// The result of a match. Matchers can return this instead of a bool to explain
+// why a match failed (e.g. which element of a collection didn't match); since
+// it converts to and from bool, matchers returning either compose the same.
+struct match_result {
+  match_result(bool matched) : matched(matched) {}
+  match_result(bool matched, std::string message)
+    : matched(matched), message(std::move(message)) {}
+
+  operator bool() const {
+    return matched;
+  }
+
+  bool matched;
+  std::string message;
+};
+
 namespace detail {
   template<typename T>
   inline auto matcher_desc(T &&matcher, typename std::enable_if<
@@ -35,65 +51,92 @@ namespace detail {
   >::type* = 0) {
     return ensure_printable(std::forward<T>(expected));
   }
+
+  // A matcher's description (or its prefix) can be a string literal, a
+  // string, or a function that returns one. Literals and functions let a
+  // matcher be created without allocating anything; the text is only built
+  // when `desc()` is called, which usually means an expectation failed.
+  inline const char * desc_text(const char *desc) {
+    return desc;
+  }
+
+  inline const std::string & desc_text(const std::string &desc) {
+    return desc;
+  }
+
+  template<typename F>
+  inline auto desc_text(const F &f) -> decltype(std::string(f())) {
+    return f();
+  }
 }
 
-template<typename T, typename F>
+template<typename T, typename F, typename D = const char *>
 class basic_matcher : public matcher_tag {
 public:
-  template<typename T2, typename F2>
-  basic_matcher(T2 &&thing, F2 &&f, const std::string &prefix)
+  template<typename T2, typename F2, typename D2>
+  basic_matcher(T2 &&thing, F2 &&f, D2 &&prefix)
     : thing_(std::forward<T2>(thing)),
       f_(std::forward<F2>(f)),
-      prefix_(prefix) {}
+      prefix_(std::forward<D2>(prefix)) {}
 
   template<typename U>
-  bool operator ()(U &&actual) const {
+  auto operator ()(U &&actual) const {
     return f_(std::forward<U>(actual), thing_.value);
   }
 
   std::string desc() const {
     std::stringstream s;
-    s << prefix_ << detail::matcher_desc(thing_.value);
+    s << detail::desc_text(prefix_) << detail::matcher_desc(thing_.value);
     return s.str();
   }
+
+  // The captured value and the function that checks against it, for matchers
+  // that wrap this one to look at.
+  const T & capture() const {
+    return thing_.value;
+  }
+
+  const F & function() const {
+    return f_;
+  }
 private:
   any_capture<T> thing_;
   F f_;
-  std::string prefix_;
+  D prefix_;
 };
 
-template<typename F>
-class basic_matcher<void, F> : public matcher_tag {
+template<typename F, typename D>
+class basic_matcher<void, F, D> : public matcher_tag {
 public:
-  template<typename F2>
-  basic_matcher(F2 &&f, const std::string &desc)
-    : f_(std::forward<F2>(f)), desc_(desc) {}
+  template<typename F2, typename D2>
+  basic_matcher(F2 &&f, D2 &&desc)
+    : f_(std::forward<F2>(f)), desc_(std::forward<D2>(desc)) {}
 
   template<typename U>
-  bool operator ()(U &&actual) const {
+  auto operator ()(U &&actual) const {
     return f_(std::forward<U>(actual));
   }
 
-  const std::string & desc() const {
-    return desc_;
+  std::string desc() const {
+    return detail::desc_text(desc_);
   }
 private:
   F f_;
-  std::string desc_;
+  D desc_;
 };
 
-template<typename T, typename F>
-inline auto make_matcher(T &&thing, F &&f, const std::string &prefix) {
+template<typename T, typename F, typename D>
+inline auto make_matcher(T &&thing, F &&f, D &&prefix) {
   return basic_matcher<
-    std::remove_reference_t<T>, std::remove_reference_t<F>
-  >(std::forward<T>(thing), std::forward<F>(f), prefix);
+    std::remove_reference_t<T>, std::remove_reference_t<F>, std::decay_t<D>
+  >(std::forward<T>(thing), std::forward<F>(f), std::forward<D>(prefix));
 }
 
-template<typename F>
-inline auto make_matcher(F &&f, const std::string &desc) {
+template<typename F, typename D>
+inline auto make_matcher(F &&f, D &&desc) {
   return basic_matcher<
-    void, std::remove_reference_t<F>
-  >(std::forward<F>(f), desc);
+    void, std::remove_reference_t<F>, std::decay_t<D>
+  >(std::forward<F>(f), std::forward<D>(desc));
 }
 
 template<typename T>
@@ -101,11 +144,35 @@ auto equal_to(T &&expected) -> basic_matcher<
   std::remove_reference_t<T>, std::equal_to<>
 >;
 
+namespace detail {
+  // Anything more to say about how `value` failed to match `matcher`, beyond
+  // the matcher's own message. This is only called once a match has failed,
+  // so it can afford to be expensive. Specialize this for matchers that can
+  // explain themselves better.
+  template<typename T, typename Matcher, typename = void>
+  struct mismatch_details {
+    static std::string describe(const T &, const Matcher &) {
+      return "";
+    }
+  };
+}
+
 template<typename T, typename Matcher>
 void expect(const T &value, const Matcher &matcher) {
-  if(!matcher(value)) {
+  match_result result = matcher(value);
+  if(!result) {
     std::stringstream s;
     s << "expected " << matcher.desc() << ", got " << ensure_printable(value);
+
+    std::string details = detail::mismatch_details<T, Matcher>::describe(
+      value, matcher
+    );
+    if(!result.message.empty()) {
+      details = details.empty() ? result.message :
+                result.message + "; " + details;
+    }
+    if(!details.empty())
+      s << " (" << details << ")";
     throw expectation_error(s.str());
   }
 }
@@ -19,7 +19,7 @@ auto thrown_raw(T &&thing) {
       catch(...) {}
 
       return false;
-    }, "threw<" + type_name<Exception>() + "> "
+    }, []() { return "threw<" + type_name<Exception>() + "> "; }
   );
 }
 
@@ -1,10 +1,28 @@
 #ifndef INC_METTLE_MATCHERS_RELATIONAL_HPP
 #define INC_METTLE_MATCHERS_RELATIONAL_HPP
 
+#include <functional>
+#include <type_traits>
+
 #include "core.hpp"
+#include "../diff.hpp"
 
 namespace mettle {
 
+namespace detail {
+  // The comparisons that the relational matchers use. Other matchers can
+  // check for these to run them over many values at once.
+  template<typename F>
+  struct is_relational : std::false_type {};
+
+  template<> struct is_relational<std::equal_to<>> : std::true_type {};
+  template<> struct is_relational<std::not_equal_to<>> : std::true_type {};
+  template<> struct is_relational<std::greater<>> : std::true_type {};
+  template<> struct is_relational<std::greater_equal<>> : std::true_type {};
+  template<> struct is_relational<std::less<>> : std::true_type {};
+  template<> struct is_relational<std::less_equal<>> : std::true_type {};
+}
+
 // Predeclared in core.hpp, so we can't use deduced return types.
 template<typename T>
 inline auto equal_to(T &&expected) -> basic_matcher<
@@ -13,6 +31,20 @@ inline auto equal_to(T &&expected) -> basic_matcher<
   return make_matcher(std::forward<T>(expected), std::equal_to<>(), "");
 }
 
+namespace detail {
+  // When two strings or collections aren't equal, show a diff of them.
+  template<typename T, typename U, typename D>
+  struct mismatch_details<
+    T, basic_matcher<U, std::equal_to<>, D>,
+    typename std::enable_if<is_diffable<U, T>::value>::type
+  > {
+    static std::string
+    describe(const T &value, const basic_matcher<U, std::equal_to<>, D> &m) {
+      return diff_values(m.capture(), value);
+    }
+  };
+}
+
 template<typename T>
 inline auto not_equal_to(T &&expected) {
   return make_matcher(std::forward<T>(expected), std::not_equal_to<>(), "not ");
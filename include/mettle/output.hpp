@@ -1,14 +1,86 @@
 #ifndef INC_METTLE_OUTPUT_HPP
 #define INC_METTLE_OUTPUT_HPP
 
-#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
 #include <sstream>
 #include <type_traits>
 #include <typeinfo>
 
 namespace mettle {
 
+// How much of a collection or tuple ensure_printable() shows. Anything past
+// these limits is left out (and never stringified at all), so that a failure
+// involving a huge container doesn't produce a huge message.
+struct print_limits {
+  // The most elements to show from any one collection.
+  size_t elements = 100;
+  // How many levels of nested collections to show.
+  size_t depth = 8;
+  // Roughly the most bytes to produce for one value, including everything
+  // nested inside it.
+  size_t bytes = 4096;
+  // The most element comparisons to spend diffing two values when showing how
+  // they differ. Past that, no diff is shown.
+  size_t diff_cost = 10000000;
+};
+
+inline print_limits & current_print_limits() {
+  static print_limits limits;
+  return limits;
+}
+
 namespace detail {
+  struct stringify_state {
+    size_t depth = 0;
+    size_t bytes = 0;
+  };
+
+  inline stringify_state & current_stringify_state() {
+    static stringify_state state;
+    return state;
+  }
+
+  // Tracks how deep we are in a value being stringified, and how many bytes
+  // it has left to use, for the duration of one collection or tuple.
+  class stringify_scope {
+  public:
+    stringify_scope()
+      : limits_(current_print_limits()), state_(current_stringify_state()),
+        outer_(state_) {
+      if(state_.depth++ == 0)
+        state_.bytes = limits_.bytes;
+      budget_ = state_.bytes;
+    }
+
+    stringify_scope(const stringify_scope &) = delete;
+    stringify_scope & operator =(const stringify_scope &) = delete;
+
+    ~stringify_scope() {
+      state_ = outer_;
+    }
+
+    bool too_deep() const {
+      return state_.depth > limits_.depth;
+    }
+
+    // Should we stop after `count` elements, having written `written` bytes?
+    // If not, the next element gets whatever bytes are left.
+    bool full(size_t count, std::streampos written) {
+      size_t used = static_cast<size_t>(written);
+      if(count >= limits_.elements || used >= budget_)
+        return true;
+      state_.bytes = budget_ - used;
+      return false;
+    }
+  private:
+    const print_limits &limits_;
+    stringify_state &state_;
+    stringify_state outer_;
+    size_t budget_;
+  };
+
   template<typename Tuple, typename Func, typename Val,
            size_t N = std::tuple_size<Tuple>::value>
   struct do_reduce {
@@ -51,6 +123,42 @@ namespace detail {
     );
   }
 
+  // Writes one character of a quoted string, escaping quotes, backslashes,
+  // and control characters so that they show up in (and don't mess with) the
+  // terminal.
+  inline void write_escaped(std::ostream &os, char c) {
+    static const char hex[] = "0123456789abcdef";
+    switch(c) {
+    case '"':  os << "\\\""; break;
+    case '\\': os << "\\\\"; break;
+    case '\t': os << "\\t";  break;
+    case '\n': os << "\\n";  break;
+    case '\r': os << "\\r";  break;
+    default:
+      auto u = static_cast<unsigned char>(c);
+      if(u < 0x20 || u == 0x7f)
+        os << "\\x" << hex[u >> 4] << hex[u & 0xf];
+      else
+        os << c;
+    }
+  }
+
+  // Quotes a string, cutting it off if it's longer than the bytes left for the
+  // value it's part of (or the whole limit, if it's on its own).
+  inline std::string stringify_string(const char *s, size_t size) {
+    const auto &state = current_stringify_state();
+    size_t budget = state.depth ? state.bytes : current_print_limits().bytes;
+
+    std::stringstream ss;
+    ss << "\"";
+    for(size_t i = 0; i != std::min(size, budget); i++)
+      write_escaped(ss, s[i]);
+    ss << "\"";
+    if(size > budget)
+      ss << "... " << size - budget << " more bytes";
+    return ss.str();
+  }
+
   template<typename T>
   std::string stringify_iterable(const T &begin, const T &end);
 
@@ -131,12 +239,12 @@ inline std::string ensure_printable(bool b) {
   return b ? "true" : "false";
 }
 
-inline auto ensure_printable(const std::string &s) {
-  return std::quoted(s);
+inline std::string ensure_printable(const std::string &s) {
+  return detail::stringify_string(s.data(), s.size());
 }
 
-inline auto ensure_printable(const char *s) {
-  return std::quoted(s);
+inline std::string ensure_printable(const char *s) {
+  return detail::stringify_string(s, std::strlen(s));
 }
 
 template<typename T, size_t N>
@@ -170,13 +278,21 @@ std::string ensure_printable(const std::tuple<T...> &tuple) {
 namespace detail {
   template<typename T>
   std::string stringify_iterable(const T &begin, const T &end) {
+    stringify_scope scope;
+    if(scope.too_deep())
+      return "[...]";
+
     std::stringstream s;
     s << "[";
-    if(begin != end) {
-      auto i = begin;
+    size_t count = 0;
+    for(auto i = begin; i != end; ++i, ++count) {
+      if(count)
+        s << ", ";
+      if(scope.full(count, s.tellp())) {
+        s << "... " << std::distance(i, end) << " more";
+        break;
+      }
       s << ensure_printable(*i);
-      for(++i; i != end; ++i)
-        s << ", " << ensure_printable(*i);
     }
     s << "]";
     return s.str();
@@ -184,12 +300,23 @@ namespace detail {
 
   template<typename T>
   std::string stringify_tuple(const T &tuple) {
+    stringify_scope scope;
+    if(scope.too_deep())
+      return "[...]";
+
     std::stringstream s;
     s << "[";
-    reduce_tuple(tuple, [&s](bool first, const auto &x, bool &) {
-      if(!first)
+    size_t count = 0;
+    reduce_tuple(tuple, [&](bool, const auto &x, bool &early_exit) {
+      if(count)
         s << ", ";
+      if(scope.full(count, s.tellp())) {
+        s << "... " << std::tuple_size<T>::value - count << " more";
+        early_exit = true;
+        return false;
+      }
       s << ensure_printable(x);
+      count++;
       return false;
     }, true);
     s << "]";
@@ -0,0 +1,210 @@
+#ifndef INC_METTLE_PROTOCOL_HPP
+#define INC_METTLE_PROTOCOL_HPP
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include "suite.hpp"
+
+namespace mettle {
+
+namespace detail {
+  // A forked test sends its result back to the parent as a series of frames:
+  // a one-byte type, a four-byte payload length, and then the payload. Frames
+  // of unknown types are skipped, so new kinds of data can be added later
+  // without confusing older readers.
+  enum class frame_type : uint8_t {
+    end     = 0,
+    outcome = 1,
+    message = 2,
+    timing  = 3,
+    usage   = 4,
+    allocations = 5,
+    bench   = 6,
+    counters = 7
+  };
+
+  constexpr size_t frame_header_size = 1 + sizeof(uint32_t);
+  constexpr size_t max_frame_size = 64 * 1024;
+
+  // Messages longer than this are cut short (by the writer, and again by the
+  // reader in case the writer misbehaves) so that a test with a runaway
+  // message can't eat all of the parent's memory.
+  constexpr size_t max_message_size = 1024 * 1024;
+
+  inline bool write_all(int fd, const char *data, size_t size) {
+    while(size) {
+      ssize_t written = write(fd, data, size);
+      if(written < 0) {
+        if(errno == EINTR)
+          continue;
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  inline bool write_frame(int fd, frame_type type, const char *data,
+                          size_t size) {
+    char header[frame_header_size];
+    uint32_t length = size;
+    header[0] = static_cast<char>(type);
+    std::memcpy(header + 1, &length, sizeof(length));
+    return write_all(fd, header, sizeof(header)) &&
+           write_all(fd, data, size);
+  }
+
+  template<typename T>
+  inline bool write_frame(int fd, frame_type type, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "frame payload must be trivially copyable");
+    return write_frame(fd, type, reinterpret_cast<const char *>(&value),
+                       sizeof(value));
+  }
+
+  inline bool write_message(int fd, const std::string &message) {
+    size_t size = std::min(message.size(), max_message_size);
+    for(size_t i = 0; i < size; i += max_frame_size) {
+      if(!write_frame(fd, frame_type::message, message.data() + i,
+                      std::min(max_frame_size, size - i)))
+        return false;
+    }
+
+    if(size == message.size())
+      return true;
+    std::string note = "... (" + std::to_string(message.size() - size) +
+                       " more bytes)";
+    return write_frame(fd, frame_type::message, note.data(), note.size());
+  }
+
+  inline bool write_result(int fd, const test_result &result) {
+    uint8_t passed = result.passed;
+    return write_frame(fd, frame_type::outcome, passed) &&
+           write_frame(fd, frame_type::timing, result.metrics.timing) &&
+           write_frame(fd, frame_type::usage, result.metrics.usage) &&
+           write_frame(fd, frame_type::allocations,
+                       result.metrics.allocations) &&
+           write_frame(fd, frame_type::bench, result.bench) &&
+           write_frame(fd, frame_type::counters, result.metrics.counters) &&
+           write_message(fd, result.message) &&
+           write_frame(fd, frame_type::end, nullptr, 0);
+  }
+
+  // Rebuilds a test_result from frames as the bytes come in. Message frames
+  // are appended straight onto the result's message; everything else is small
+  // enough to collect and decode once the whole frame is in.
+  class frame_reader {
+  public:
+    // Consume up to `size` bytes, stopping after an end frame so that any
+    // remaining bytes can be handed to a fresh reader. Returns the number of
+    // bytes consumed.
+    size_t feed(const char *data, size_t size) {
+      size_t consumed = 0;
+      while(consumed != size && !done_) {
+        if(header_size_ != frame_header_size) {
+          size_t n = std::min(size - consumed, frame_header_size - header_size_);
+          std::memcpy(header_ + header_size_, data + consumed, n);
+          header_size_ += n;
+          consumed += n;
+          if(header_size_ == frame_header_size) {
+            std::memcpy(&remaining_, header_ + 1, sizeof(remaining_));
+            payload_.clear();
+            if(remaining_ == 0)
+              finish_frame();
+          }
+          continue;
+        }
+
+        size_t n = std::min<size_t>(size - consumed, remaining_);
+        if(type() == frame_type::message) {
+          size_t room = max_message_size - std::min(
+            result_.message.size(), max_message_size
+          );
+          result_.message.append(data + consumed, std::min(n, room));
+        }
+        else if(payload_.size() < max_frame_size) {
+          payload_.append(data + consumed, n);
+        }
+        consumed += n;
+        remaining_ -= n;
+        if(remaining_ == 0)
+          finish_frame();
+      }
+      return consumed;
+    }
+
+    // True once we've seen an end frame *and* an outcome; anything less means
+    // the writer died partway through.
+    bool done() const {
+      return done_ && has_outcome_;
+    }
+
+    test_result & result() {
+      return result_;
+    }
+
+    void reset() {
+      *this = frame_reader();
+    }
+  private:
+    frame_type type() const {
+      return static_cast<frame_type>(header_[0]);
+    }
+
+    template<typename T>
+    void decode(T &value) {
+      if(payload_.size() == sizeof(T))
+        std::memcpy(&value, payload_.data(), sizeof(T));
+    }
+
+    void finish_frame() {
+      switch(type()) {
+      case frame_type::end:
+        done_ = true;
+        break;
+      case frame_type::outcome:
+        has_outcome_ = payload_.size() == 1;
+        result_.passed = has_outcome_ && payload_[0];
+        break;
+      case frame_type::timing:
+        decode(result_.metrics.timing);
+        break;
+      case frame_type::usage:
+        decode(result_.metrics.usage);
+        break;
+      case frame_type::allocations:
+        decode(result_.metrics.allocations);
+        break;
+      case frame_type::bench:
+        decode(result_.bench);
+        break;
+      case frame_type::counters:
+        decode(result_.metrics.counters);
+        break;
+      default:
+        break;
+      }
+      header_size_ = 0;
+    }
+
+    char header_[frame_header_size];
+    size_t header_size_ = 0;
+    uint32_t remaining_ = 0;
+    std::string payload_;
+    test_result result_;
+    bool has_outcome_ = false;
+    bool done_ = false;
+  };
+}
+
+} // namespace mettle
+
+#endif
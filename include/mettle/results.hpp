@@ -0,0 +1,254 @@
+#ifndef INC_METTLE_RESULTS_HPP
+#define INC_METTLE_RESULTS_HPP
+
+#include <chrono>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "runner.hpp"
+
+namespace mettle {
+
+namespace detail {
+  // Escape a field for a results file, so that it doesn't contain any tabs or
+  // newlines.
+  inline std::string escape_field(const std::string &s) {
+    std::string result;
+    result.reserve(s.size());
+    for(char c : s) {
+      switch(c) {
+      case '\\': result += "\\\\"; break;
+      case '\t': result += "\\t";  break;
+      case '\n': result += "\\n";  break;
+      case '\r': result += "\\r";  break;
+      default:   result += c;
+      }
+    }
+    return result;
+  }
+
+  inline std::string unescape_field(const std::string &s) {
+    std::string result;
+    result.reserve(s.size());
+    for(size_t i = 0; i != s.size(); i++) {
+      if(s[i] != '\\' || i + 1 == s.size()) {
+        result += s[i];
+        continue;
+      }
+
+      switch(s[++i]) {
+      case 't': result += '\t'; break;
+      case 'n': result += '\n'; break;
+      case 'r': result += '\r'; break;
+      default:  result += s[i];
+      }
+    }
+    return result;
+  }
+
+  inline std::vector<std::string> split_fields(const std::string &line) {
+    std::vector<std::string> fields;
+    size_t start = 0, end;
+    do {
+      end = line.find('\t', start);
+      fields.push_back(unescape_field(line.substr(start, end - start)));
+      start = end + 1;
+    } while(end != std::string::npos);
+    return fields;
+  }
+}
+
+// Writes the results of a run in a form that's easy for other tools to read
+// (e.g. to merge the results of several shards). Each line is a record of
+// tab-separated fields, with backslashes, tabs, and newlines escaped as in C:
+//
+//   run      SHARD  SHARD-COUNT
+//   test     OUTCOME  WALL-NS  CPU-NS  MAX-RSS-KB  MESSAGE  SUITE...  TEST
+//   summary  TESTS  PASSED  FAILED  TIMED-OUT  SKIPPED  WALL-NS
+//
+// OUTCOME is one of `passed`, `failed`, `timed_out`, or `skipped`. A test's
+// name is split into one field per suite, followed by the test's own name.
+// Shards are numbered starting from 1. Every run ends with a summary line, so
+// a file without one was cut short.
+class results_logger : public test_logger {
+public:
+  results_logger(std::ostream &out, size_t shard = 0, size_t shard_count = 1)
+    : out_(out), shard_(shard), shard_count_(shard_count) {}
+
+  void start_run() {
+    tests_ = passes_ = failures_ = timeouts_ = skips_ = 0;
+    run_start_ = std::chrono::steady_clock::now();
+    out_ << "run\t" << shard_ + 1 << "\t" << shard_count_ << "\n";
+  }
+
+  void end_run() {
+    auto wall = std::chrono::steady_clock::now() - run_start_;
+    out_ << "summary\t" << tests_ << "\t" << passes_ << "\t" << failures_
+         << "\t" << timeouts_ << "\t" << skips_ << "\t"
+         << std::chrono::duration_cast<std::chrono::nanoseconds>(wall).count()
+         << std::endl;
+  }
+
+  void start_suite(const std::vector<std::string> &) {}
+  void end_suite(const std::vector<std::string> &) {}
+
+  void start_test(const test_name &) {
+    tests_++;
+  }
+
+  void passed_test(const test_name &test, const test_metrics &metrics) {
+    passes_++;
+    write_test(test, "passed", metrics, "");
+  }
+
+  void skipped_test(const test_name &test) {
+    skips_++;
+    write_test(test, "skipped", test_metrics(), "");
+  }
+
+  void failed_test(const test_name &test, const std::string &message,
+                   const test_metrics &metrics) {
+    failures_++;
+    write_test(test, "failed", metrics, message);
+  }
+
+  void timed_out_test(const test_name &test,
+                      std::chrono::milliseconds elapsed) {
+    timeouts_++;
+    test_metrics metrics;
+    metrics.timing.test.wall = elapsed;
+    write_test(test, "timed_out", metrics, "");
+  }
+private:
+  void write_test(const test_name &test, const char *outcome,
+                  const test_metrics &metrics, const std::string &message) {
+    using detail::escape_field;
+    auto total = metrics.timing.total();
+    out_ << "test\t" << outcome << "\t" << total.wall.count() << "\t"
+         << total.cpu.count() << "\t" << metrics.usage.max_rss << "\t"
+         << escape_field(message);
+    for(const auto &i : test.suites)
+      out_ << "\t" << escape_field(i);
+    out_ << "\t" << escape_field(test.test) << "\n";
+  }
+
+  std::ostream &out_;
+  size_t shard_, shard_count_;
+  size_t tests_, passes_, failures_, timeouts_, skips_;
+  std::chrono::steady_clock::time_point run_start_;
+};
+
+// Reads a results file written by results_logger and passes the results on to
+// another logger, as though the tests had been run here. This lets us show the
+// results of other test binaries. Every suite is nested inside `prefix`, and
+// tests are given fresh ids. It's up to the caller to start and end the run.
+class results_reader {
+public:
+  results_reader(test_logger &logger, std::vector<std::string> prefix = {})
+    : logger_(logger), prefix_(std::move(prefix)) {}
+
+  results_reader(const results_reader &) = delete;
+  results_reader & operator =(const results_reader &) = delete;
+
+  // Read some data, which needn't end at a line boundary.
+  void feed(const char *data, size_t size) {
+    partial_.append(data, size);
+    size_t start = 0, end;
+    while((end = partial_.find('\n', start)) != std::string::npos) {
+      read_line(partial_.substr(start, end - start));
+      start = end + 1;
+    }
+    partial_.erase(0, start);
+  }
+
+  // Read a single line. Returns false if the line wasn't understood, in which
+  // case it's ignored.
+  bool read_line(const std::string &line) {
+    auto fields = detail::split_fields(line);
+    if(fields[0] == "run")
+      return true;
+    if(fields[0] == "summary") {
+      done_ = true;
+      return true;
+    }
+    if(fields[0] != "test" || fields.size() < 8)
+      return false;
+
+    test_name name;
+    name.suites = prefix_;
+    name.suites.insert(name.suites.end(), fields.begin() + 6,
+                       fields.end() - 1);
+    name.test = fields.back();
+    name.id = detail::id_generator<size_t>::generate();
+
+    test_metrics metrics;
+    char *end;
+    metrics.timing.test.wall = std::chrono::nanoseconds(
+      std::strtoll(fields[2].c_str(), &end, 10)
+    );
+    metrics.timing.test.cpu = std::chrono::nanoseconds(
+      std::strtoll(fields[3].c_str(), &end, 10)
+    );
+    metrics.usage.max_rss = std::strtol(fields[4].c_str(), &end, 10);
+
+    const auto &outcome = fields[1];
+    if(outcome != "passed" && outcome != "failed" && outcome != "skipped" &&
+       outcome != "timed_out")
+      return false;
+
+    enter_suite(name.suites);
+    logger_.start_test(name);
+    if(outcome == "passed") {
+      logger_.passed_test(name, metrics);
+    }
+    else if(outcome == "failed") {
+      logger_.failed_test(name, fields[5], metrics);
+    }
+    else if(outcome == "skipped") {
+      logger_.skipped_test(name);
+    }
+    else {
+      logger_.timed_out_test(
+        name, std::chrono::duration_cast<std::chrono::milliseconds>(
+          metrics.timing.test.wall
+        )
+      );
+    }
+    return true;
+  }
+
+  // Whether we've seen the summary at the end of a run.
+  bool done() const {
+    return done_;
+  }
+
+  // End the current suite, if any. Call this once there's nothing more to
+  // read.
+  void finish() {
+    if(in_suite_)
+      logger_.end_suite(suites_);
+    in_suite_ = false;
+  }
+private:
+  void enter_suite(const std::vector<std::string> &suites) {
+    if(in_suite_ && suites_ == suites)
+      return;
+    finish();
+    suites_ = suites;
+    in_suite_ = true;
+    logger_.start_suite(suites_);
+  }
+
+  test_logger &logger_;
+  std::vector<std::string> prefix_;
+  std::vector<std::string> suites_;
+  std::string partial_;
+  bool in_suite_ = false;
+  bool done_ = false;
+};
+
+} // namespace mettle
+
+#endif
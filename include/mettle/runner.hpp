@@ -1,11 +1,28 @@
 #ifndef INC_METTLE_RUNNER_HPP
 #define INC_METTLE_RUNNER_HPP
 
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <system_error>
 
+#include "filter.hpp"
+#include "protocol.hpp"
 #include "suite.hpp"
 
 namespace mettle {
@@ -54,105 +71,1064 @@ public:
   virtual void end_suite(const std::vector<std::string> &suites) = 0;
 
   virtual void start_test(const test_name &test) = 0;
-  virtual void passed_test(const test_name &test) = 0;
+  virtual void passed_test(const test_name &test,
+                           const test_metrics &metrics) = 0;
   virtual void skipped_test(const test_name &test) = 0;
-  virtual void failed_test(const test_name &test,
-                           const std::string &message) = 0;
+  virtual void failed_test(const test_name &test, const std::string &message,
+                           const test_metrics &metrics) = 0;
+  virtual void timed_out_test(const test_name &test,
+                              std::chrono::milliseconds elapsed) = 0;
+
+  // A benchmark that passed. By default, this is logged like any other passed
+  // test.
+  virtual void passed_bench(const test_name &test, const bench_stats &,
+                            const test_metrics &metrics) {
+    passed_test(test, metrics);
+  }
+};
+
+// Forwards every event to each of a list of loggers, in order.
+class logger_group : public test_logger {
+public:
+  logger_group(std::initializer_list<test_logger*> loggers = {})
+    : loggers_(loggers) {}
+
+  void add(test_logger &logger) {
+    loggers_.push_back(&logger);
+  }
+
+  void start_run() {
+    for(auto &i : loggers_) i->start_run();
+  }
+  void end_run() {
+    for(auto &i : loggers_) i->end_run();
+  }
+
+  void start_suite(const std::vector<std::string> &suites) {
+    for(auto &i : loggers_) i->start_suite(suites);
+  }
+  void end_suite(const std::vector<std::string> &suites) {
+    for(auto &i : loggers_) i->end_suite(suites);
+  }
+
+  void start_test(const test_name &test) {
+    for(auto &i : loggers_) i->start_test(test);
+  }
+  void passed_test(const test_name &test, const test_metrics &metrics) {
+    for(auto &i : loggers_) i->passed_test(test, metrics);
+  }
+  void skipped_test(const test_name &test) {
+    for(auto &i : loggers_) i->skipped_test(test);
+  }
+  void failed_test(const test_name &test, const std::string &message,
+                   const test_metrics &metrics) {
+    for(auto &i : loggers_) i->failed_test(test, message, metrics);
+  }
+  void timed_out_test(const test_name &test,
+                      std::chrono::milliseconds elapsed) {
+    for(auto &i : loggers_) i->timed_out_test(test, elapsed);
+  }
+  void passed_bench(const test_name &test, const bench_stats &stats,
+                    const test_metrics &metrics) {
+    for(auto &i : loggers_) i->passed_bench(test, stats, metrics);
+  }
+private:
+  std::vector<test_logger*> loggers_;
+};
+
+// Splits the tests into `count` parts (e.g. for running on several machines)
+// and selects the one at `index`. Tests are assigned by a hash of their name,
+// so every shard agrees on who runs what without talking to each other. If
+// `cost` is set, it's used to balance the shards by how long their tests are
+// expected to take instead; every shard must then use the same costs.
+struct test_shard {
+  size_t index = 0;
+  size_t count = 1;
+  std::function<std::chrono::nanoseconds(const test_name &)> cost;
 };
 
 namespace detail {
-  inline test_result run_test(const std::function<test_result(void)> &test) {
-    int pipefd[2];
-    if(pipe(pipefd) < 0)
-      throw std::system_error(errno, std::generic_category());
+  using steady_clock = std::chrono::steady_clock;
 
-    pid_t pid;
-    if((pid = fork()) < 0)
-      throw std::system_error(errno, std::generic_category());
+  // A hash of a string that's the same on every run (and every machine), for
+  // identifying tests by name across runs. This is FNV-1a.
+  inline uint64_t stable_hash(const std::string &s) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(unsigned char c : s) {
+      hash ^= c;
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  inline std::chrono::nanoseconds to_duration(const timeval &tv) {
+    return std::chrono::seconds(tv.tv_sec) +
+           std::chrono::microseconds(tv.tv_usec);
+  }
+
+  inline test_usage to_usage(const rusage &ru) {
+    test_usage usage;
+    usage.user = to_duration(ru.ru_utime);
+    usage.system = to_duration(ru.ru_stime);
+    usage.max_rss = ru.ru_maxrss;
+    usage.minor_faults = ru.ru_minflt;
+    usage.major_faults = ru.ru_majflt;
+    usage.voluntary_switches = ru.ru_nvcsw;
+    usage.involuntary_switches = ru.ru_nivcsw;
+    usage.block_inputs = ru.ru_inblock;
+    usage.block_outputs = ru.ru_oublock;
+    return usage;
+  }
 
-    if(pid == 0) {
-      close(pipefd[0]);
-      auto result = test();
-      if(write(pipefd[1], result.message.c_str(), result.message.length()) < 0)
-        exit(1); // XXX: Pass the errno somehow?
+  // Everything but max_rss is a delta from `before`; max_rss is a high-water
+  // mark, so the best we can do is report the peak so far.
+  inline test_usage usage_since(const rusage &before) {
+    rusage after;
+    getrusage(RUSAGE_SELF, &after);
+
+    auto usage = to_usage(after);
+    auto prev = to_usage(before);
+    usage.user -= prev.user;
+    usage.system -= prev.system;
+    usage.minor_faults -= prev.minor_faults;
+    usage.major_faults -= prev.major_faults;
+    usage.voluntary_switches -= prev.voluntary_switches;
+    usage.involuntary_switches -= prev.involuntary_switches;
+    usage.block_inputs -= prev.block_inputs;
+    usage.block_outputs -= prev.block_outputs;
+    return usage;
+  }
+
+  // Run a test, recording what resources it used. The test times itself, so
+  // that it can split out setup and teardown. If `count_hw` is set, this also
+  // reads the hardware counters, opening them first if this process hasn't
+  // yet.
+  inline test_result measure_test(const std::function<test_result(void)> &test,
+                                  bool count_hw = false) {
+    auto *counters = count_hw ? &open_counters() : nullptr;
+    hw_counters hw_before;
+    if(counters)
+      hw_before = counters->read();
+
+    rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    auto result = test();
+    result.metrics.usage = usage_since(before);
+
+    if(counters)
+      result.metrics.counters = counters_since(hw_before, counters->read());
+    return result;
+  }
+
+  inline test_result error_result(int error) {
+    char err[256] = "";
+    strerror_r(error, err, sizeof(err));
+    return { false, err };
+  }
+
+  inline test_result status_result(int status, std::string &&message) {
+    if(WIFSIGNALED(status))
+      return { false, strsignal(WTERMSIG(status)) };
+
+    return { WIFEXITED(status) && WEXITSTATUS(status) == 0,
+             std::move(message) };
+  }
+
+  class forked_test {
+  public:
+    // If `own_group` is set, the test gets its own process group so that if
+    // it times out, we can kill anything it spawned along with it. Otherwise,
+    // it stays in ours, so that e.g. Ctrl-C at the terminal still reaches it
+    // and it can still read from the terminal.
+    forked_test(const std::function<test_result(void)> &test,
+                bool count_hw = false, bool own_group = false)
+      : own_group_(own_group) {
+      int pipefd[2];
+      if(pipe(pipefd) < 0)
+        throw std::system_error(errno, std::generic_category());
+
+      if((pid_ = fork()) < 0) {
+        int err = errno;
+        close(pipefd[0]);
+        close(pipefd[1]);
+        throw std::system_error(err, std::generic_category());
+      }
+
+      if(pid_ == 0) {
+        if(own_group_)
+          setpgid(0, 0);
+        close(pipefd[0]);
+        auto result = measure_test(test, count_hw);
+        if(!write_result(pipefd[1], result))
+          exit(1); // XXX: Pass the errno somehow?
+        close(pipefd[1]);
+        exit(result.passed ? 0 : 1);
+      }
+
+      if(own_group_)
+        setpgid(pid_, pid_);
       close(pipefd[1]);
-      exit(result.passed ? 0 : 1);
+      fd_ = pipefd[0];
     }
-    else {
-      close(pipefd[1]);
 
-      std::stringstream message;
-      ssize_t size;
-      char buf[BUFSIZ];
-      while((size = read(pipefd[0], buf, sizeof(buf))) > 0)
-        message.write(buf, size);
-      close(pipefd[0]);
+    forked_test(const forked_test &) = delete;
+    forked_test & operator =(const forked_test &) = delete;
+
+    ~forked_test() {
+      if(fd_ >= 0)
+        close(fd_);
+    }
+
+    int fd() const {
+      return fd_;
+    }
 
-      if(size < 0) { // read() failed!
-        char err[256] = "";
-        strerror_r(errno, err, sizeof(err));
-        return { false, err };
+    // Read whatever the child has written so far. Returns false once the child
+    // has closed its end of the pipe (or reading failed), at which point
+    // wait() should be called.
+    bool read() {
+      char buf[BUFSIZ];
+      ssize_t size = ::read(fd_, buf, sizeof(buf));
+      if(size > 0) {
+        reader_.feed(buf, size);
+        return true;
       }
 
-      int status;
-      if(waitpid(pid, &status, 0) < 0) {
-        char err[256] = "";
-        strerror_r(errno, err, sizeof(err));
-        return { false, err };
+      if(size < 0)
+        error_ = errno;
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+
+    void kill() {
+      ::kill(own_group_ ? -pid_ : pid_, SIGKILL);
+      close(fd_);
+      fd_ = -1;
+      waitpid(pid_, nullptr, 0);
+    }
+
+    // Since the child only ever runs this one test, the kernel's accounting
+    // for it is the test's resource usage. This is more complete than what
+    // the child can measure itself: it includes anything the test waited on,
+    // and it's still available if the test crashed.
+    test_result wait() {
+      if(error_) { // read() failed!
+        waitpid(pid_, nullptr, 0);
+        return error_result(error_);
       }
 
-      if(WIFSIGNALED(status))
-        return { false, strsignal(WTERMSIG(status)) };
+      int status;
+      rusage usage;
+      if(wait4(pid_, &status, 0, &usage) < 0)
+        return error_result(errno);
 
-      return { WIFEXITED(status) && WEXITSTATUS(status) == 0, message.str() };
+      auto result = reader_.done() && !WIFSIGNALED(status) ?
+        std::move(reader_.result()) :
+        status_result(status, std::move(reader_.result().message));
+      result.metrics.usage = to_usage(usage);
+      return result;
     }
+  private:
+    pid_t pid_;
+    int fd_ = -1;
+    int error_ = 0;
+    bool own_group_;
+    frame_reader reader_;
+  };
+
+  inline test_result run_test(const std::function<test_result(void)> &test,
+                              bool count_hw = false) {
+    forked_test child(test, count_hw);
+    while(child.read()) {}
+    return child.wait();
   }
 
+  struct test_plan {
+    struct entry {
+      size_t suite;
+      // Null for a suite with no tests of its own; we still keep an entry for
+      // it so that the logger sees the suite.
+      const runnable_suite::test_info *test;
+    };
+
+    std::vector<std::vector<std::string>> suites;
+    std::vector<entry> entries;
+  };
+
+  // Filtered-out tests never make it into the plan, so they cost nothing
+  // more than a check of their names, and we don't even look at the tests in
+  // suites that the filter rules out.
   template<typename T>
-  void run_tests_impl(const T &suites, test_logger &logger, bool fork_tests,
-                      std::vector<std::string> &parents) {
+  void build_plan(const T &suites, test_plan &plan,
+                  std::vector<std::string> &parents,
+                  const test_filter &filter) {
     for(const auto &suite : suites) {
       parents.push_back(suite.name());
+      if(!filter.check_suite(parents)) {
+        parents.pop_back();
+        continue;
+      }
 
-      logger.start_suite(parents);
-
+      size_t index = plan.suites.size();
+      plan.suites.push_back(parents);
+      // When filtering, only show the suites with tests that were selected.
+      if(suite.size() == 0 && filter.empty())
+        plan.entries.push_back({index, nullptr});
       for(const auto &test : suite) {
-        const test_name name = {parents, test.name, test.id};
-        logger.start_test(name);
+        if(filter(parents, test.name))
+          plan.entries.push_back({index, &test});
+      }
+
+      build_plan(suite.subsuites(), plan, parents, filter);
+      parents.pop_back();
+    }
+  }
+
+  // Sets up each suite's shared fixture (see setup_all()) in this process just
+  // before the first of its tests starts, so that forked tests inherit it, and
+  // tears it down once the last of its tests is done.
+  class fixture_tracker {
+  public:
+    fixture_tracker(const test_plan &plan) {
+      for(const auto &entry : plan.entries) {
+        if(entry.test && !entry.test->skip) {
+          for(const auto &i : entry.test->suite_fixtures)
+            remaining_[i.get()]++;
+        }
+      }
+    }
 
-        if(test.skip) {
-          logger.skipped_test(name);
+    fixture_tracker(const fixture_tracker &) = delete;
+    fixture_tracker & operator =(const fixture_tracker &) = delete;
+
+    // Anything left over (e.g. because we stopped early) is torn down in the
+    // reverse of the order it was set up.
+    ~fixture_tracker() {
+      for(auto i = active_.rbegin(); i != active_.rend(); ++i)
+        teardown(*i);
+    }
+
+    void acquire(const test_plan::entry &entry) {
+      for(const auto &i : entry.test->suite_fixtures) {
+        if(i->ready())
           continue;
+        // If this fails, the test will try again and report the error.
+        try {
+          i->setup();
+          active_.push_back(i.get());
         }
+        catch(...) {}
+      }
+    }
 
-        auto result = fork_tests ? run_test(test.function) : test.function();
-        if(result.passed)
-          logger.passed_test(name);
-        else
-          logger.failed_test(name, result.message);
+    void release(const test_plan::entry &entry) {
+      const auto &fixtures = entry.test->suite_fixtures;
+      for(auto i = fixtures.rbegin(); i != fixtures.rend(); ++i) {
+        if(--remaining_[i->get()] == 0)
+          teardown(i->get());
+      }
+    }
+  private:
+    // There's no test to blame a failed teardown on, so just carry on.
+    static void teardown(suite_fixture_base *fixture) {
+      try {
+        fixture->teardown();
       }
+      catch(...) {}
+    }
 
-      logger.end_suite(parents);
+    std::map<suite_fixture_base*, size_t> remaining_;
+    std::vector<suite_fixture_base*> active_;
+  };
 
-      run_tests_impl(suite.subsuites(), logger, fork_tests, parents);
-      parents.pop_back();
+  // Passes results to the logger in the order of the plan, holding on to any
+  // results that arrive early. This keeps the logger's view of a run the same
+  // regardless of how many tests are running at once.
+  class plan_reporter {
+  public:
+    plan_reporter(const test_plan &plan, test_logger &logger)
+      : plan_(plan), logger_(logger), fixtures_(plan),
+        outcomes_(plan.entries.size()) {}
+
+    // Call this just before starting the test at `index`.
+    void start(size_t index) {
+      fixtures_.acquire(plan_.entries[index]);
+    }
+
+    void report(size_t index, test_result &&result) {
+      fixtures_.release(plan_.entries[index]);
+      if(!result.passed)
+        failures_++;
+      outcomes_[index].state = test_state::done;
+      outcomes_[index].result = std::move(result);
+    }
+
+    void report_timeout(size_t index, std::chrono::milliseconds elapsed) {
+      fixtures_.release(plan_.entries[index]);
+      failures_++;
+      outcomes_[index].state = test_state::timed_out;
+      outcomes_[index].elapsed = elapsed;
+    }
+
+    // Log everything before `available` (the number of entries dispatched so
+    // far), stopping at the first test that's still running.
+    void flush(size_t available) {
+      for(; next_ < available; next_++) {
+        const auto &entry = plan_.entries[next_];
+        if(!started_) {
+          enter_suite(entry.suite);
+          if(entry.test)
+            logger_.start_test(name(entry));
+          started_ = true;
+        }
+
+        if(entry.test) {
+          if(entry.test->skip) {
+            logger_.skipped_test(name(entry));
+          }
+          else {
+            auto &outcome = outcomes_[next_];
+            if(outcome.state == test_state::pending)
+              return;
+
+            if(outcome.state == test_state::timed_out)
+              logger_.timed_out_test(name(entry), outcome.elapsed);
+            else if(outcome.result.passed && entry.test->bench)
+              logger_.passed_bench(name(entry), outcome.result.bench,
+                                   outcome.result.metrics);
+            else if(outcome.result.passed)
+              logger_.passed_test(name(entry), outcome.result.metrics);
+            else
+              logger_.failed_test(name(entry), outcome.result.message,
+                                  outcome.result.metrics);
+            outcome.result = {};
+          }
+        }
+        started_ = false;
+      }
+    }
+
+    // The number of failures reported so far, including ones that haven't
+    // been logged yet.
+    size_t failures() const {
+      return failures_;
+    }
+
+    void finish(size_t available) {
+      flush(available);
+      if(suite_ != no_suite)
+        logger_.end_suite(plan_.suites[suite_]);
+    }
+  private:
+    static constexpr size_t no_suite = static_cast<size_t>(-1);
+
+    enum class test_state : char {
+      pending,
+      done,
+      timed_out
+    };
+
+    struct outcome {
+      test_state state = test_state::pending;
+      test_result result;
+      std::chrono::milliseconds elapsed;
+    };
+
+    test_name name(const test_plan::entry &entry) const {
+      return {plan_.suites[entry.suite], entry.test->name, entry.test->id};
+    }
+
+    // Filtering, sharding, or reordering the plan can leave out a suite's
+    // parents, so show any of them that the logger isn't already inside.
+    void enter_suite(size_t suite) {
+      if(suite_ == suite)
+        return;
+
+      const auto &path = plan_.suites[suite];
+      size_t shared = 0;
+      if(suite_ != no_suite) {
+        const auto &prev = plan_.suites[suite_];
+        logger_.end_suite(prev);
+        while(shared != prev.size() && shared + 1 < path.size() &&
+              prev[shared] == path[shared])
+          shared++;
+      }
+
+      for(size_t i = shared + 1; i < path.size(); i++) {
+        std::vector<std::string> parent(path.begin(), path.begin() + i);
+        logger_.start_suite(parent);
+        logger_.end_suite(parent);
+      }
+
+      suite_ = suite;
+      logger_.start_suite(path);
+    }
+
+    const test_plan &plan_;
+    test_logger &logger_;
+    fixture_tracker fixtures_;
+    std::vector<outcome> outcomes_;
+    size_t next_ = 0;
+    size_t failures_ = 0;
+    size_t suite_ = no_suite;
+    bool started_ = false;
+  };
+
+  inline bool runnable(const test_plan::entry &entry) {
+    return entry.test && !entry.test->skip;
+  }
+
+  // Reorder the runnable tests in the plan according to `compare`, keeping the
+  // declaration order for ties. Skipped tests go first, since they don't take
+  // any time, and suites without tests are dropped, since they'd just show up
+  // as noise out of their usual place. The reporter ends and restarts suites
+  // (and their parents) as needed, so the logger still sees each test inside
+  // its suite.
+  template<typename Compare>
+  void order_plan(test_plan &plan, const Compare &compare) {
+    plan.entries.erase(std::remove_if(
+      plan.entries.begin(), plan.entries.end(),
+      [](const test_plan::entry &entry) { return !entry.test; }
+    ), plan.entries.end());
+    auto first = std::stable_partition(
+      plan.entries.begin(), plan.entries.end(),
+      [](const test_plan::entry &entry) { return !runnable(entry); }
+    );
+
+    std::vector<std::pair<test_name, test_plan::entry>> tests;
+    for(auto i = first; i != plan.entries.end(); ++i) {
+      tests.push_back({
+        {plan.suites[i->suite], i->test->name, i->test->id}, *i
+      });
+    }
+
+    std::stable_sort(tests.begin(), tests.end(), [&compare](
+      const auto &lhs, const auto &rhs
+    ) {
+      return compare(lhs.first, rhs.first);
+    });
+
+    for(const auto &i : tests)
+      *first++ = i.second;
+  }
+
+  // Whether we've seen enough failures to stop starting new tests. A limit of
+  // zero means we never stop.
+  inline bool failed_enough(const plan_reporter &reporter, size_t fail_fast) {
+    return fail_fast && reporter.failures() >= fail_fast;
+  }
+
+  inline void shard_plan(test_plan &plan, const test_shard &shard) {
+    struct candidate {
+      size_t index;
+      uint64_t hash;
+      std::chrono::nanoseconds cost;
+    };
+
+    // Suites with no tests belong to no shard; each shard shows whichever
+    // of them are parents of its own tests.
+    const size_t nobody = static_cast<size_t>(-1);
+    std::vector<size_t> owner(plan.entries.size(), nobody);
+    std::vector<candidate> balanced;
+    for(size_t i = 0; i != plan.entries.size(); i++) {
+      const auto &entry = plan.entries[i];
+      if(!entry.test)
+        continue;
+
+      test_name name = {plan.suites[entry.suite], entry.test->name,
+                        entry.test->id};
+      auto hash = stable_hash(name.full_name());
+      if(shard.cost && runnable(entry))
+        balanced.push_back({i, hash, shard.cost(name)});
+      else
+        owner[i] = hash % shard.count;
+    }
+
+    // Hand out the most expensive tests first, each to the shard with the
+    // least work so far. Ties are broken by name (via the hash) rather than by
+    // declaration order, so that all shards come to the same answer.
+    std::sort(balanced.begin(), balanced.end(), [](
+      const candidate &lhs, const candidate &rhs
+    ) {
+      if(lhs.cost != rhs.cost)
+        return lhs.cost > rhs.cost;
+      return lhs.hash < rhs.hash;
+    });
+
+    std::vector<std::pair<std::chrono::nanoseconds, size_t>> load(
+      shard.count, {std::chrono::nanoseconds(0), 0}
+    );
+    for(const auto &i : balanced) {
+      auto least = std::min_element(load.begin(), load.end());
+      least->first += i.cost;
+      least->second++;
+      owner[i.index] = least - load.begin();
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i != plan.entries.size(); i++) {
+      if(owner[i] == shard.index)
+        plan.entries[kept++] = plan.entries[i];
+    }
+    plan.entries.resize(kept);
+  }
+
+  // The run_plan_* functions return how many entries of the plan they got to.
+  inline size_t run_plan_inline(const test_plan &plan, plan_reporter &reporter,
+                                size_t fail_fast, bool count_hw) {
+    size_t i = 0;
+    for(; i != plan.entries.size(); i++) {
+      if(failed_enough(reporter, fail_fast))
+        break;
+
+      reporter.flush(i + 1);
+      if(runnable(plan.entries[i])) {
+        reporter.start(i);
+        reporter.report(i, measure_test(plan.entries[i].test->function,
+                                        count_hw));
+        reporter.flush(i + 1);
+      }
     }
+    return i;
+  }
+
+  inline steady_clock::time_point
+  test_deadline(const test_plan::entry &entry, steady_clock::time_point start,
+                std::chrono::milliseconds default_timeout) {
+    auto timeout = entry.test->timeout.count() ? entry.test->timeout :
+                   default_timeout;
+    return timeout.count() ? start + timeout : steady_clock::time_point::max();
+  }
+
+  inline std::chrono::milliseconds
+  elapsed_since(steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      steady_clock::now() - start
+    );
+  }
+
+  // Waits until at least one of `fds` is readable or `deadline` passes. If
+  // we're interrupted, just return; callers check everything again anyway.
+  inline void poll_readable(std::vector<pollfd> &fds,
+                            steady_clock::time_point deadline) {
+    int timeout = -1;
+    if(deadline != steady_clock::time_point::max()) {
+      // Round up so that we don't wake up a hair before the deadline and spin.
+      auto remaining = deadline - steady_clock::now() +
+                       std::chrono::milliseconds(1) - steady_clock::duration(1);
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        remaining
+      ).count();
+      timeout = static_cast<int>(std::min<decltype(ms)>(
+        std::max<decltype(ms)>(ms, 0), std::numeric_limits<int>::max()
+      ));
+    }
+
+    if(poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+      throw std::system_error(errno, std::generic_category());
+  }
+
+  // Forks a fresh child for every test, keeping up to `jobs` of them alive.
+  class fork_executor {
+  public:
+    fork_executor(const test_plan &plan, size_t jobs,
+                  std::chrono::milliseconds timeout, bool count_hw = false)
+      : plan_(plan), jobs_(jobs), timeout_(timeout), count_hw_(count_hw) {}
+
+    bool full() const {
+      return running_.size() == jobs_;
+    }
+
+    bool busy() const {
+      return !running_.empty();
+    }
+
+    void start(size_t index) {
+      const auto &entry = plan_.entries[index];
+      auto start = steady_clock::now();
+      auto deadline = test_deadline(entry, start, timeout_);
+      running_.push_back({
+        index, start, deadline, std::make_unique<forked_test>(
+          entry.test->function, count_hw_,
+          deadline != steady_clock::time_point::max()
+        )
+      });
+    }
+
+    void wait(plan_reporter &reporter) {
+      auto deadline = steady_clock::time_point::max();
+      fds_.clear();
+      for(const auto &i : running_) {
+        fds_.push_back({i.child->fd(), POLLIN, 0});
+        deadline = std::min(deadline, i.deadline);
+      }
+      poll_readable(fds_, deadline);
+
+      // Walk backwards so that erasing finished tests doesn't disturb the
+      // indices we haven't looked at yet.
+      auto now = steady_clock::now();
+      for(size_t i = fds_.size(); i-- != 0;) {
+        auto &test = running_[i];
+        if(fds_[i].revents && !test.child->read()) {
+          reporter.report(test.index, test.child->wait());
+        }
+        else if(test.deadline <= now) {
+          test.child->kill();
+          reporter.report_timeout(test.index, elapsed_since(test.start));
+        }
+        else {
+          continue;
+        }
+        running_.erase(running_.begin() + i);
+      }
+    }
+  private:
+    struct running_test {
+      size_t index;
+      steady_clock::time_point start, deadline;
+      std::unique_ptr<forked_test> child;
+    };
+
+    const test_plan &plan_;
+    size_t jobs_;
+    std::chrono::milliseconds timeout_;
+    bool count_hw_;
+    std::vector<running_test> running_;
+    std::vector<pollfd> fds_;
+  };
+
+  // Forks `jobs` long-lived workers up front and hands each of them tests to
+  // run, one at a time. A worker that dies mid-test is charged with the
+  // failure and replaced the next time its slot is needed.
+  class worker_pool {
+  public:
+    worker_pool(const test_plan &plan, size_t jobs,
+                std::chrono::milliseconds timeout, bool count_hw = false)
+      : plan_(plan), workers_(jobs), timeout_(timeout), count_hw_(count_hw) {
+      // Workers only need their own process groups (see forked_test) if any
+      // of the tests they might run can time out.
+      own_groups_ = timeout.count() != 0;
+      for(const auto &entry : plan.entries) {
+        if(runnable(entry) && entry.test->timeout.count())
+          own_groups_ = true;
+      }
+    }
+
+    worker_pool(const worker_pool &) = delete;
+    worker_pool & operator =(const worker_pool &) = delete;
+
+    ~worker_pool() {
+      // Closing the socket tells an idle worker to exit; anything still busy
+      // (e.g. if we're unwinding from an exception) gets killed.
+      for(auto &w : workers_) {
+        if(w.pid <= 0)
+          continue;
+        close(w.fd);
+        if(w.busy)
+          kill_worker(w);
+        waitpid(w.pid, nullptr, 0);
+      }
+    }
+
+    bool full() const {
+      return busy_ == workers_.size();
+    }
+
+    bool busy() const {
+      return busy_ != 0;
+    }
+
+    void start(size_t index) {
+      auto w = std::find_if(workers_.begin(), workers_.end(),
+                            [](const worker &w) { return !w.busy; });
+      if(w->pid <= 0)
+        spawn(*w);
+
+      if(send(w->fd, &index, sizeof(index), MSG_NOSIGNAL) < 0) {
+        // The worker died while idle; replace it and try once more.
+        reap(*w);
+        spawn(*w);
+        if(send(w->fd, &index, sizeof(index), MSG_NOSIGNAL) < 0)
+          throw std::system_error(errno, std::generic_category());
+      }
+
+      w->busy = true;
+      w->index = index;
+      w->start = steady_clock::now();
+      w->deadline = test_deadline(plan_.entries[index], w->start, timeout_);
+      busy_++;
+    }
+
+    void wait(plan_reporter &reporter) {
+      auto deadline = steady_clock::time_point::max();
+      fds_.clear();
+      busy_workers_.clear();
+      for(auto &w : workers_) {
+        if(w.busy) {
+          fds_.push_back({w.fd, POLLIN, 0});
+          busy_workers_.push_back(&w);
+          deadline = std::min(deadline, w.deadline);
+        }
+      }
+      poll_readable(fds_, deadline);
+
+      auto now = steady_clock::now();
+      for(size_t i = 0; i != fds_.size(); i++) {
+        auto &w = *busy_workers_[i];
+        if(fds_[i].revents) {
+          char buf[BUFSIZ];
+          ssize_t size = recv(w.fd, buf, sizeof(buf), 0);
+          if(size > 0) {
+            w.reader.feed(buf, size);
+            if(w.reader.done()) {
+              finish(w, reporter, std::move(w.reader.result()));
+              w.reader.reset();
+              continue;
+            }
+          }
+          else {
+            // The worker went away in the middle of a test, so we blame the
+            // test. status_result() tells us why it died.
+            int err = size < 0 ? errno : 0;
+            int status = reap(w);
+            finish(w, reporter, err ? error_result(err) : status_result(
+              status, std::move(w.reader.result().message)
+            ));
+            w.reader.reset();
+            continue;
+          }
+        }
+
+        // Check the deadline even if the worker just sent us something, or a
+        // test that keeps writing would never time out.
+        if(w.deadline <= now) {
+          // Take down the worker and anything the test spawned; the slot gets
+          // a fresh worker next time around.
+          kill_worker(w);
+          reap(w);
+          reporter.report_timeout(w.index, elapsed_since(w.start));
+          w.busy = false;
+          busy_--;
+        }
+      }
+    }
+  private:
+    struct worker {
+      pid_t pid = 0;
+      int fd = -1;
+      bool busy = false;
+      size_t index = 0;
+      steady_clock::time_point start, deadline;
+      frame_reader reader;
+    };
+
+    void spawn(worker &w) {
+      int sockets[2];
+      if(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0)
+        throw std::system_error(errno, std::generic_category());
+
+      pid_t pid;
+      if((pid = fork()) < 0) {
+        int err = errno;
+        close(sockets[0]);
+        close(sockets[1]);
+        throw std::system_error(err, std::generic_category());
+      }
+
+      if(pid == 0) {
+        if(own_groups_)
+          setpgid(0, 0);
+        // Don't hold on to our siblings' sockets, or they'd never see us hang
+        // up when it's time to exit.
+        for(const auto &i : workers_) {
+          if(i.pid > 0)
+            close(i.fd);
+        }
+        close(sockets[0]);
+        serve(sockets[1]);
+      }
+
+      if(own_groups_)
+        setpgid(pid, pid);
+      close(sockets[1]);
+      w.pid = pid;
+      w.fd = sockets[0];
+      w.reader.reset();
+    }
+
+    [[noreturn]] void serve(int fd) {
+      // Any shared fixture that wasn't set up when we were forked gets set up
+      // here by the first test that needs it. That copy is ours alone, so we
+      // have to tear it down ourselves before exiting.
+      std::vector<suite_fixture_base *> own;
+      for(auto *i : plan_fixtures()) {
+        if(!i->ready())
+          own.push_back(i);
+      }
+
+      int status = 0;
+      size_t index;
+      while(recv(fd, &index, sizeof(index), MSG_WAITALL) == sizeof(index)) {
+        const auto &test = plan_.entries[index].test->function;
+        if(!write_result(fd, measure_test(test, count_hw_))) {
+          status = 1;
+          break;
+        }
+      }
+
+      for(auto i = own.rbegin(); i != own.rend(); ++i) {
+        try {
+          (*i)->teardown();
+        }
+        catch(...) {}
+      }
+      close(fd);
+      exit(status);
+    }
+
+    // Every shared fixture in the plan, with outer suites' fixtures before
+    // those of the suites inside them.
+    std::vector<suite_fixture_base *> plan_fixtures() const {
+      std::vector<suite_fixture_base *> fixtures;
+      for(const auto &entry : plan_.entries) {
+        if(!entry.test)
+          continue;
+        for(const auto &i : entry.test->suite_fixtures) {
+          if(std::find(fixtures.begin(), fixtures.end(), i.get()) ==
+             fixtures.end())
+            fixtures.push_back(i.get());
+        }
+      }
+      return fixtures;
+    }
+
+    void kill_worker(const worker &w) {
+      kill(own_groups_ ? -w.pid : w.pid, SIGKILL);
+    }
+
+    int reap(worker &w) {
+      int status = 0;
+      close(w.fd);
+      waitpid(w.pid, &status, 0);
+      w.pid = 0;
+      w.fd = -1;
+      return status;
+    }
+
+    void finish(worker &w, plan_reporter &reporter, test_result &&result) {
+      reporter.report(w.index, std::move(result));
+      w.busy = false;
+      busy_--;
+    }
+
+    const test_plan &plan_;
+    std::vector<worker> workers_;
+    std::chrono::milliseconds timeout_;
+    bool count_hw_;
+    bool own_groups_;
+    size_t busy_ = 0;
+    std::vector<pollfd> fds_;
+    std::vector<worker *> busy_workers_;
+  };
+
+  template<typename Executor>
+  size_t run_plan_parallel(const test_plan &plan, plan_reporter &reporter,
+                           Executor &executor, size_t fail_fast) {
+    size_t next = 0;
+    auto more = [&]() {
+      return next != plan.entries.size() &&
+             !failed_enough(reporter, fail_fast);
+    };
+
+    // Once we've stopped starting tests, let the ones already running finish
+    // so that their results are still reported.
+    while(more() || executor.busy()) {
+      while(!executor.full() && more()) {
+        if(runnable(plan.entries[next])) {
+          reporter.start(next);
+          executor.start(next);
+        }
+        reporter.flush(++next);
+      }
+
+      if(executor.busy()) {
+        executor.wait(reporter);
+        reporter.flush(next);
+      }
+    }
+    return next;
   }
 }
 
+struct run_options {
+  bool fork_tests = true;
+  bool worker_pool = false;
+  size_t jobs = 1;
+  // Applies to any test without a timeout of its own; zero means no timeout.
+  // Timeouts are only enforced when tests are forked.
+  std::chrono::milliseconds timeout = std::chrono::milliseconds(0);
+  // If set, tests are dispatched (and logged) sorted by this comparison rather
+  // than in the order they were declared.
+  std::function<bool(const test_name &, const test_name &)> order;
+  // Stop starting new tests after this many have failed; zero means never.
+  size_t fail_fast = 0;
+  // Which tests to run; by default, all of them.
+  test_filter filter;
+  test_shard shard;
+  // Read the hardware performance counters around each test (and each
+  // benchmark's iterations). Where they're unavailable, the counts are too.
+  bool hw_counters = false;
+};
+
 template<typename T>
 inline void run_tests(const T &suites, test_logger &logger,
-                      bool fork_tests = true) {
+                      const run_options &options) {
+  detail::test_plan plan;
   std::vector<std::string> parents;
+  detail::build_plan(suites, plan, parents, options.filter);
+  if(options.shard.count > 1)
+    detail::shard_plan(plan, options.shard);
+  if(options.order)
+    detail::order_plan(plan, options.order);
+
+  detail::plan_reporter reporter(plan, logger);
+  size_t jobs = std::max<size_t>(options.jobs, 1);
+  size_t done;
   logger.start_run();
-  detail::run_tests_impl(suites, logger, fork_tests, parents);
+  if(!options.fork_tests) {
+    done = detail::run_plan_inline(plan, reporter, options.fail_fast,
+                                   options.hw_counters);
+  }
+  else if(options.worker_pool) {
+    detail::worker_pool executor(plan, jobs, options.timeout,
+                                 options.hw_counters);
+    done = detail::run_plan_parallel(plan, reporter, executor,
+                                     options.fail_fast);
+  }
+  else {
+    detail::fork_executor executor(plan, jobs, options.timeout,
+                                   options.hw_counters);
+    done = detail::run_plan_parallel(plan, reporter, executor,
+                                     options.fail_fast);
+  }
+  reporter.finish(done);
   logger.end_run();
 }
 
+template<typename T>
+inline void run_tests(const T &suites, test_logger &logger,
+                      bool fork_tests = true, size_t jobs = 1) {
+  run_options options;
+  options.fork_tests = fork_tests;
+  options.jobs = jobs;
+  run_tests(suites, logger, options);
+}
+
 template<typename T>
 inline void run_tests(const T &suites, test_logger &&logger,
-                      bool fork_tests = true) {
-  run_tests(suites, logger, fork_tests);
+                      bool fork_tests = true, size_t jobs = 1) {
+  run_tests(suites, logger, fork_tests, jobs);
 }
 
 } // namespace mettle
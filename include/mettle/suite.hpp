@@ -1,15 +1,21 @@
 #ifndef INC_METTLE_SUITE_HPP
 #define INC_METTLE_SUITE_HPP
 
+#include <time.h>
+
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
+#include "bench.hpp"
 #include "type_name.hpp"
 
 namespace mettle {
@@ -28,24 +34,186 @@ namespace detail {
     return apply_impl(std::forward<F>(f), std::forward<Tuple>(t), Indices());
   }
 
+  inline std::chrono::nanoseconds cpu_time() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) +
+           std::chrono::nanoseconds(ts.tv_nsec);
+  }
+
+  // Running totals of heap allocations. These only move if the allocation
+  // hooks in allocation_hooks.hpp are compiled in; otherwise, they stay at
+  // zero.
+  struct allocation_counters {
+    std::atomic<long> count{0}, frees{0}, bytes{0}, freed_bytes{0};
+  };
+
+  inline allocation_counters & allocation_counts() {
+    static allocation_counters counts;
+    return counts;
+  }
+
+  struct allocation_snapshot {
+    static allocation_snapshot now() {
+      const auto &counts = allocation_counts();
+      auto get = [](const std::atomic<long> &n) {
+        return n.load(std::memory_order_relaxed);
+      };
+      return { get(counts.count), get(counts.frees), get(counts.bytes),
+               get(counts.freed_bytes) };
+    }
+
+    long count, frees, bytes, freed_bytes;
+  };
+
+  struct timestamp {
+    static timestamp now() {
+      return { std::chrono::steady_clock::now(), cpu_time(),
+               allocation_snapshot::now() };
+    }
+
+    std::chrono::steady_clock::time_point wall;
+    std::chrono::nanoseconds cpu;
+    allocation_snapshot allocations;
+  };
+
+  // Where the body of the running test began and ended. Tests in subsuites
+  // are wrapped once per level of nesting, and each level calls run_test(), so
+  // the real body begins at the *last* call into a test function and ends at
+  // the *first* return from one.
+  struct body_marks {
+    timestamp begin, end;
+    bool began = false, ended = false;
+  };
+
+  inline body_marks & current_body_marks() {
+    static body_marks marks;
+    return marks;
+  }
+
+  inline void end_body(body_marks &marks) {
+    if(!marks.ended) {
+      marks.end = timestamp::now();
+      marks.ended = true;
+    }
+  }
+
   template<typename F, typename Tuple>
   void run_test(F &&setup, F &&teardown, F&&test, Tuple &fixtures) {
     if(setup)
       detail::apply(std::forward<F>(setup), fixtures);
 
+    auto &marks = current_body_marks();
+    marks.begin = timestamp::now();
+    marks.began = true;
     try {
       detail::apply(std::forward<F>(test), fixtures);
     }
     catch(...) {
+      end_body(marks);
       if(teardown)
         detail::apply(std::forward<F>(teardown), fixtures);
       throw;
     }
+    end_body(marks);
 
     if(teardown)
       detail::apply(std::forward<F>(teardown), fixtures);
   }
 
+  // The state behind a suite's setup_all() and teardown_all(). The runner sets
+  // this up in its own process before starting any of the suite's tests, so
+  // that forked tests inherit it, and tears it down once they're all done. A
+  // test that finds it hasn't been set up (e.g. in a worker process that was
+  // forked earlier) sets it up for itself, and the worker tears its copy down
+  // when it exits.
+  class suite_fixture_base {
+  public:
+    virtual ~suite_fixture_base() {}
+
+    // If setting up fails, every later attempt fails the same way, so that
+    // each of the suite's tests reports the error.
+    void setup() {
+      if(ready_)
+        return;
+      if(!error_.empty())
+        throw std::runtime_error(error_);
+
+      try {
+        do_setup();
+      }
+      catch(const std::exception &e) {
+        error_ = std::string("setup_all failed: ") + e.what();
+        throw std::runtime_error(error_);
+      }
+      catch(...) {
+        error_ = "setup_all failed: unknown exception";
+        throw std::runtime_error(error_);
+      }
+      ready_ = true;
+    }
+
+    void teardown() {
+      if(ready_) {
+        ready_ = false;
+        do_teardown();
+      }
+    }
+
+    bool ready() const {
+      return ready_;
+    }
+  protected:
+    virtual void do_setup() = 0;
+    virtual void do_teardown() = 0;
+  private:
+    bool ready_ = false;
+    std::string error_;
+  };
+
+  // The fixtures are only constructed while the suite is set up, so that
+  // they don't take up any memory outside of that.
+  template<typename ...T>
+  class suite_fixture : public suite_fixture_base {
+  public:
+    using function_type = std::function<void(T&...)>;
+
+    suite_fixture(const function_type &setup, const function_type &teardown)
+      : setup_(setup), teardown_(teardown) {}
+
+    std::tuple<T...> & fixtures() {
+      return *fixtures_;
+    }
+  private:
+    void do_setup() {
+      auto fixtures = std::make_unique<std::tuple<T...>>();
+      if(setup_)
+        detail::apply(setup_, *fixtures);
+      fixtures_ = std::move(fixtures);
+    }
+
+    void do_teardown() {
+      auto fixtures = std::move(fixtures_);
+      if(teardown_)
+        detail::apply(teardown_, *fixtures);
+    }
+
+    function_type setup_, teardown_;
+    std::unique_ptr<std::tuple<T...>> fixtures_;
+  };
+
+  using suite_fixture_list = std::vector<std::shared_ptr<suite_fixture_base>>;
+
+  // Add a suite's shared fixture (if any) to the list of those a test needs,
+  // in order from the outermost suite in.
+  inline suite_fixture_list
+  add_suite_fixture(const std::shared_ptr<suite_fixture_base> &fixture,
+                    suite_fixture_list fixtures) {
+    if(fixture)
+      fixtures.insert(fixtures.begin(), fixture);
+    return fixtures;
+  }
+
   template<typename T>
   class id_generator {
   public:
@@ -65,11 +233,82 @@ namespace detail {
   }
 }
 
+struct test_timing {
+  struct phase {
+    std::chrono::nanoseconds wall{}, cpu{};
+  };
+
+  phase total() const {
+    return { setup.wall + test.wall + teardown.wall,
+             setup.cpu + test.cpu + teardown.cpu };
+  }
+
+  // Setup covers everything before the test body (including constructing
+  // fixtures), and teardown everything after it.
+  phase setup, test, teardown;
+};
+
+struct test_usage {
+  std::chrono::nanoseconds user{}, system{};
+  long max_rss = 0; // In kilobytes.
+  long minor_faults = 0, major_faults = 0;
+  long voluntary_switches = 0, involuntary_switches = 0;
+  long block_inputs = 0, block_outputs = 0;
+};
+
+// What the test body allocated on the heap (only counted when the allocation
+// hooks are compiled in). net_bytes is what was allocated minus what was
+// freed, so a positive value means the body left that much memory behind.
+struct test_allocations {
+  long count = 0, frees = 0;
+  long bytes = 0, net_bytes = 0;
+};
+
+struct test_metrics {
+  test_timing timing;
+  test_usage usage;
+  test_allocations allocations;
+  hw_counters counters;
+};
+
 struct test_result {
+  test_result(bool passed = false, std::string message = "")
+    : passed(passed), message(std::move(message)) {}
+
   bool passed;
   std::string message;
+  test_metrics metrics;
+  bench_stats bench; // Only filled in for benchmarks.
 };
 
+namespace detail {
+  inline test_timing split_phases(const timestamp &begin, const timestamp &end,
+                                  const body_marks &marks) {
+    auto phase = [](const timestamp &from, const timestamp &to) {
+      return test_timing::phase{ to.wall - from.wall, to.cpu - from.cpu };
+    };
+
+    // If setup failed, there was no body, so charge it all to setup.
+    if(!marks.began)
+      return { phase(begin, end), {}, {} };
+    return { phase(begin, marks.begin), phase(marks.begin, marks.end),
+             phase(marks.end, end) };
+  }
+
+  inline test_allocations body_allocations(const body_marks &marks) {
+    if(!marks.began)
+      return {};
+
+    const auto &from = marks.begin.allocations, &to = marks.end.allocations;
+    test_allocations result;
+    result.count = to.count - from.count;
+    result.frees = to.frees - from.frees;
+    result.bytes = to.bytes - from.bytes;
+    result.net_bytes = result.bytes - (to.freed_bytes - from.freed_bytes);
+    return result;
+  }
+}
+
 template<typename Ret, typename ...T>
 class compiled_suite {
 public:
@@ -77,13 +316,21 @@ public:
     using function_type = std::function<Ret(T&...)>;
 
     test_info(const std::string &name, const function_type &function,
-              bool skip = false)
-      : name(name), function(function), skip(skip),
+              bool skip = false,
+              std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+              detail::suite_fixture_list suite_fixtures = {},
+              bool bench = false)
+      : name(name), function(function), skip(skip), timeout(timeout),
+        suite_fixtures(std::move(suite_fixtures)), bench(bench),
         id(detail::id_generator<size_t>::generate()) {}
 
     std::string name;
     function_type function;
     bool skip;
+    std::chrono::milliseconds timeout;
+    // The shared fixtures (from setup_all) this test uses, outermost first.
+    detail::suite_fixture_list suite_fixtures;
+    bool bench;
     size_t id;
   };
 
@@ -183,11 +430,25 @@ public:
   }
 
   void skip_test(const std::string &name, const function_type &f) {
-    tests_.push_back({name, f, true});
+    tests_.push_back({name, f, true, std::chrono::milliseconds(0), {}, false});
   }
 
-  void test(const std::string &name, const function_type &f) {
-    tests_.push_back({name, f, false});
+  void test(const std::string &name, const function_type &f,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+    tests_.push_back({name, f, false, timeout, {}, false});
+  }
+
+  // A benchmark runs like a test (with the same setup, teardown, and
+  // fixtures), except that its body is called over and over to time it.
+  void bench(const std::string &name, const function_type &f,
+             const bench_options &options = {}) {
+    function_type body = [f, options](T &...args) {
+      detail::current_bench_stats() = detail::run_bench(options, [&]() {
+        f(args...);
+      });
+    };
+    tests_.push_back({name, body, false, std::chrono::milliseconds(0), {},
+                      true});
   }
 
   void subsuite(const compiled_suite<void, T...> &subsuite) {
@@ -219,6 +480,9 @@ protected:
     std::string name;
     function_type function;
     bool skip;
+    std::chrono::milliseconds timeout;
+    detail::suite_fixture_list suite_fixtures;
+    bool bench;
   };
 
   std::string name_;
@@ -235,26 +499,58 @@ private:
   using base = suite_builder_base<T..., U...>;
 public:
   using compiled_suite_type = compiled_suite<void, T...>;
+  using suite_fixture_type = detail::suite_fixture<U...>;
   using base::base;
 
+  // Set up this subsuite's fixture once, and share it among all its tests.
+  void setup_all(const typename suite_fixture_type::function_type &f) {
+    setup_all_ = f;
+  }
+
+  void teardown_all(const typename suite_fixture_type::function_type &f) {
+    teardown_all_ = f;
+  }
+
   compiled_suite_type finalize() const {
+    std::shared_ptr<suite_fixture_type> shared;
+    if(setup_all_ || teardown_all_) {
+      shared = std::make_shared<suite_fixture_type>(setup_all_,
+                                                    teardown_all_);
+    }
+
     return compiled_suite_type(
       base::name_, base::tests_, base::subsuites_,
-      [this](const auto &a) { return wrap_test(a); }
+      [this, shared](const auto &a) { return wrap_test(a, shared); }
     );
   }
 private:
   template<typename V>
-  typename compiled_suite_type::test_info wrap_test(const V &test) const {
+  typename compiled_suite_type::test_info
+  wrap_test(const V &test,
+            const std::shared_ptr<suite_fixture_type> &shared) const {
     typename compiled_suite_type::test_info::function_type test_function = [
-      setup = base::setup_, teardown = base::teardown_, f = test.function
+      setup = base::setup_, teardown = base::teardown_, f = test.function,
+      shared
     ](T &...args) -> void {
-      std::tuple<T&..., U...> fixtures(args..., U()...);
-      detail::run_test(setup, teardown, f, fixtures);
+      if(shared) {
+        shared->setup();
+        std::tuple<T&..., U&...> fixtures(
+          args..., std::get<U>(shared->fixtures())...
+        );
+        detail::run_test(setup, teardown, f, fixtures);
+      }
+      else {
+        std::tuple<T&..., U...> fixtures(args..., U()...);
+        detail::run_test(setup, teardown, f, fixtures);
+      }
     };
 
-    return { test.name, test_function, test.skip };
+    return { test.name, test_function, test.skip, test.timeout,
+             detail::add_suite_fixture(shared, test.suite_fixtures),
+             test.bench };
   }
+
+  typename suite_fixture_type::function_type setup_all_, teardown_all_;
 };
 
 template<typename Exception, typename ...T>
@@ -264,26 +560,61 @@ private:
   using base = suite_builder_base<T...>;
 public:
   using exception_type = Exception;
+  using suite_fixture_type = detail::suite_fixture<T...>;
   using base::base;
 
+  // Set up this suite's fixture once, and share it among all its tests
+  // (including those in its subsuites).
+  void setup_all(const typename suite_fixture_type::function_type &f) {
+    setup_all_ = f;
+  }
+
+  void teardown_all(const typename suite_fixture_type::function_type &f) {
+    teardown_all_ = f;
+  }
+
   runnable_suite finalize() const {
+    std::shared_ptr<suite_fixture_type> shared;
+    if(setup_all_ || teardown_all_) {
+      shared = std::make_shared<suite_fixture_type>(setup_all_,
+                                                    teardown_all_);
+    }
+
     return runnable_suite(
       base::name_, base::tests_, base::subsuites_,
-      [this](const auto &a) { return wrap_test(a); }
+      [this, shared](const auto &a) { return wrap_test(a, shared); }
     );
   }
 private:
   template<typename U>
-  runnable_suite::test_info wrap_test(const U &test) const {
+  runnable_suite::test_info
+  wrap_test(const U &test,
+            const std::shared_ptr<suite_fixture_type> &shared) const {
     runnable_suite::test_info::function_type test_function = [
-      setup = base::setup_, teardown = base::teardown_, f = test.function
+      setup = base::setup_, teardown = base::teardown_, f = test.function,
+      shared
     ]() -> test_result {
       bool passed = false;
       std::string message;
 
+      // Tests can run other tests (mettle's own tests do, at least), so save
+      // the outer test's marks and restore them when we're done.
+      auto &marks = detail::current_body_marks();
+      auto outer_marks = marks;
+      marks = {};
+      auto &stats = detail::current_bench_stats();
+      auto outer_stats = stats;
+      stats = {};
+      auto begin = detail::timestamp::now();
       try {
-        std::tuple<T...> fixtures;
-        detail::run_test(setup, teardown, f, fixtures);
+        if(shared) {
+          shared->setup();
+          detail::run_test(setup, teardown, f, shared->fixtures());
+        }
+        else {
+          std::tuple<T...> fixtures;
+          detail::run_test(setup, teardown, f, fixtures);
+        }
         passed = true;
       }
       catch(const exception_type &e) {
@@ -296,11 +627,23 @@ private:
         message = "Unknown exception";
       }
 
-      return { passed, message };
+      test_result result(passed, message);
+      result.metrics.timing = detail::split_phases(
+        begin, detail::timestamp::now(), marks
+      );
+      result.metrics.allocations = detail::body_allocations(marks);
+      result.bench = stats;
+      marks = outer_marks;
+      stats = outer_stats;
+      return result;
     };
 
-    return { test.name, test_function, test.skip };
+    return { test.name, test_function, test.skip, test.timeout,
+             detail::add_suite_fixture(shared, test.suite_fixtures),
+             test.bench };
   }
+
+  typename suite_fixture_type::function_type setup_all_, teardown_all_;
 };
 
 template<typename Exception, typename ...Fixture, typename F>
@@ -334,6 +677,45 @@ make_basic_suites(const std::string &name, const F &f) {
   }};
 }
 
+// A suite that hasn't been built yet. Building a suite runs its builder
+// function and creates all of its tests, so this lets us put that off until we
+// know the suite is going to be run.
+struct suite_factory {
+  std::string name;
+  std::function<runnable_suite(void)> make;
+};
+
+template<typename Exception, typename ...Fixture, typename F>
+suite_factory make_suite_factory(const std::string &name, const F &f) {
+  return { name, [name, f]() {
+    return make_basic_suite<Exception, Fixture...>(name, f);
+  } };
+}
+
+template<typename Exception, typename F>
+std::array<suite_factory, 1>
+make_suite_factories(const std::string &name, const F &f) {
+  return {{ make_suite_factory<Exception>(name, f) }};
+}
+
+template<typename Exception, typename Fixture, typename F>
+std::array<suite_factory, 1>
+make_suite_factories(const std::string &name, const F &f) {
+  return {{ make_suite_factory<Exception, Fixture>(name, f) }};
+}
+
+template<typename Exception, typename First, typename Second, typename ...Rest,
+         typename F>
+std::array<suite_factory, sizeof...(Rest) + 2>
+make_suite_factories(const std::string &name, const F &f) {
+  using detail::annotate_type;
+  return {{
+    make_suite_factory<Exception, First>(annotate_type<First>(name), f),
+    make_suite_factory<Exception, Second>(annotate_type<Second>(name), f),
+    make_suite_factory<Exception, Rest>(annotate_type<Rest>(name), f)...
+  }};
+}
+
 template<typename Parent, typename ...Fixture, typename F>
 typename subsuite_builder<Parent, Fixture...>::compiled_suite_type
 make_subsuite(const std::string &name, const F &f) {
@@ -0,0 +1,256 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include <mettle/loggers.hpp>
+#include <mettle/results.hpp>
+#include <mettle/term.hpp>
+
+// Runs a set of mettle test binaries in parallel, collecting their results over
+// a pipe (passed to each binary as its --results-file) and showing them as
+// though they were one big run. Results are shown in the order the binaries
+// were listed, with each binary acting as a suite around its own tests.
+
+namespace mettle {
+
+namespace detail {
+  class test_binary {
+  public:
+    test_binary(const std::string &path, test_logger &logger)
+      : path_(path), logger_(logger), reader_(logger, {path}) {}
+
+    test_binary(const test_binary &) = delete;
+    test_binary & operator =(const test_binary &) = delete;
+
+    ~test_binary() {
+      if(fd_ >= 0)
+        close(fd_);
+    }
+
+    void start() {
+      int pipefd[2];
+      if(pipe2(pipefd, O_CLOEXEC) < 0)
+        throw std::system_error(errno, std::generic_category());
+
+      if((pid_ = fork()) < 0) {
+        int err = errno;
+        close(pipefd[0]);
+        close(pipefd[1]);
+        throw std::system_error(err, std::generic_category());
+      }
+
+      if(pid_ == 0) {
+        // The results go to fd 3. The binary's own summary would just repeat
+        // what we show, so throw it away.
+        if(pipefd[1] == 3)
+          fcntl(3, F_SETFD, 0);
+        else
+          dup2(pipefd[1], 3);
+
+        int devnull = open("/dev/null", O_WRONLY);
+        if(devnull >= 0)
+          dup2(devnull, STDOUT_FILENO);
+
+        execl(path_.c_str(), path_.c_str(), "--results-file", "/dev/fd/3",
+              nullptr);
+        std::cerr << "unable to run " << path_ << ": " << strerror(errno)
+                  << std::endl;
+        _exit(127);
+      }
+
+      close(pipefd[1]);
+      fd_ = pipefd[0];
+    }
+
+    int fd() const {
+      return fd_;
+    }
+
+    bool running() const {
+      return fd_ >= 0;
+    }
+
+    // Read whatever the binary has written so far. Results are held until
+    // this binary is shown. Returns false once the binary is done.
+    bool read() {
+      char buf[BUFSIZ];
+      ssize_t size = ::read(fd_, buf, sizeof(buf));
+      if(size > 0) {
+        if(showing_)
+          reader_.feed(buf, size);
+        else
+          pending_.append(buf, size);
+        return true;
+      }
+
+      close(fd_);
+      fd_ = -1;
+      waitpid(pid_, &status_, 0);
+      finished_ = true;
+      return false;
+    }
+
+    // Start passing results on to the logger as they come in. Returns true if
+    // the binary has finished, in which case it's been completely shown.
+    bool show() {
+      if(!showing_) {
+        showing_ = true;
+        reader_.feed(pending_.data(), pending_.size());
+        pending_.clear();
+      }
+      if(!finished_)
+        return false;
+
+      if(!reader_.done())
+        report_crash();
+      reader_.finish();
+      return true;
+    }
+  private:
+    // If the binary never finished its run, note that as a failure of its
+    // own, since we have no idea what tests we're missing.
+    void report_crash() {
+      std::string message;
+      if(WIFSIGNALED(status_))
+        message = strsignal(WTERMSIG(status_));
+      else
+        message = "exited with status " + std::to_string(
+          WEXITSTATUS(status_)
+        ) + " before finishing";
+
+      reader_.finish();
+      test_name name = {{path_}, "(test binary)",
+                        id_generator<size_t>::generate()};
+      logger_.start_suite(name.suites);
+      logger_.start_test(name);
+      logger_.failed_test(name, message, test_metrics());
+      logger_.end_suite(name.suites);
+    }
+
+    std::string path_;
+    test_logger &logger_;
+    results_reader reader_;
+    pid_t pid_ = 0;
+    int fd_ = -1;
+    int status_ = 0;
+    std::string pending_;
+    bool showing_ = false;
+    bool finished_ = false;
+  };
+
+  inline void run_binaries(const std::vector<std::string> &paths,
+                           test_logger &logger, size_t jobs) {
+    std::vector<std::unique_ptr<test_binary>> binaries;
+    for(const auto &i : paths)
+      binaries.push_back(std::make_unique<test_binary>(i, logger));
+
+    logger.start_run();
+    size_t next_start = 0, next_show = 0, running = 0;
+    while(next_show != binaries.size()) {
+      while(running < jobs && next_start != binaries.size()) {
+        binaries[next_start++]->start();
+        running++;
+      }
+
+      std::vector<pollfd> fds;
+      std::vector<test_binary*> polled;
+      for(size_t i = 0; i != next_start; i++) {
+        if(binaries[i]->running()) {
+          fds.push_back({binaries[i]->fd(), POLLIN, 0});
+          polled.push_back(binaries[i].get());
+        }
+      }
+
+      if(!fds.empty()) {
+        if(poll(fds.data(), fds.size(), -1) < 0) {
+          if(errno == EINTR)
+            continue;
+          throw std::system_error(errno, std::generic_category());
+        }
+
+        for(size_t i = 0; i != fds.size(); i++) {
+          if(fds[i].revents && !polled[i]->read())
+            running--;
+        }
+      }
+
+      while(next_show != next_start && binaries[next_show]->show())
+        next_show++;
+    }
+    logger.end_run();
+  }
+}
+
+} // namespace mettle
+
+int main(int argc, const char *argv[]) {
+  using namespace mettle::detail;
+  namespace opts = boost::program_options;
+
+  opts::options_description desc("Allowed options");
+  desc.add_options()
+    ("help,h", "show help")
+    ("verbose", opts::value<unsigned int>()->implicit_value(1),
+     "show verbose output")
+    ("color", "show colored output")
+    ("jobs,j", opts::value<size_t>(),
+     "number of test binaries to run in parallel")
+    ("slowest", opts::value<size_t>(), "show the N slowest tests")
+  ;
+
+  opts::options_description hidden;
+  hidden.add_options()
+    ("binary", opts::value<std::vector<std::string>>(), "test binaries")
+  ;
+
+  opts::options_description all;
+  all.add(desc).add(hidden);
+
+  opts::positional_options_description positional;
+  positional.add("binary", -1);
+
+  opts::variables_map args;
+  opts::store(opts::command_line_parser(argc, argv).options(all)
+              .positional(positional).run(), args);
+  opts::notify(args);
+
+  if(args.count("help")) {
+    std::cout << "Usage: " << argv[0] << " [options] binary..." << std::endl
+              << desc << std::endl;
+    return 1;
+  }
+
+  if(!args.count("binary")) {
+    std::cout << "no test binaries, exiting" << std::endl;
+    return 1;
+  }
+
+  unsigned int verbosity = args.count("verbose") ?
+    args["verbose"].as<unsigned int>() : 0;
+  term::colors_enabled = args.count("color");
+
+  size_t jobs = args.count("jobs") ? args["jobs"].as<size_t>() :
+                std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  if(jobs == 0) {
+    std::cout << "no jobs, exiting" << std::endl;
+    return 1;
+  }
+
+  size_t slowest = args.count("slowest") ? args["slowest"].as<size_t>() : 0;
+  verbose_logger vlog(std::cout, verbosity);
+  single_run_logger logger(vlog, slowest);
+  run_binaries(args["binary"].as<std::vector<std::string>>(), logger, jobs);
+  logger.summarize();
+
+  return logger.failures();
+}
@@ -1,5 +1,11 @@
 #include "test_output.cpp"
 #include "test_matchers.cpp"
 #include "test_suite.cpp"
+#include "test_protocol.cpp"
+#include "test_history.cpp"
+#include "test_filter.cpp"
+#include "test_results.cpp"
+#include "test_baseline.cpp"
+#include "test_loggers.cpp"
 #include "test_runner.cpp"
 #include "test_driver.cpp"
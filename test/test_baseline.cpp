@@ -0,0 +1,187 @@
+#include <mettle.hpp>
+using namespace mettle;
+
+#include <sstream>
+
+struct bench_event_logger : test_logger {
+  void start_run() {}
+  void end_run() {}
+
+  void start_suite(const std::vector<std::string> &) {}
+  void end_suite(const std::vector<std::string> &) {}
+
+  void start_test(const test_name &) {}
+  void passed_test(const test_name &test, const test_metrics &) {
+    events.push_back("passed " + test.test);
+  }
+  void skipped_test(const test_name &) {}
+  void failed_test(const test_name &test, const std::string &message,
+                   const test_metrics &) {
+    events.push_back("failed " + test.test + ": " + message);
+  }
+  void timed_out_test(const test_name &, std::chrono::milliseconds) {}
+  void passed_bench(const test_name &test, const bench_stats &,
+                    const test_metrics &) {
+    events.push_back("passed bench " + test.test);
+  }
+
+  std::vector<std::string> events;
+};
+
+bench_stats stats_of(double mean, double stddev, size_t samples = 10) {
+  bench_stats stats;
+  stats.samples = samples;
+  stats.iterations = 100;
+  stats.mean = stats.median = bench_stats::duration(mean);
+  stats.stddev = bench_stats::duration(stddev);
+  stats.min = bench_stats::duration(mean - stddev);
+  stats.max = bench_stats::duration(mean + stddev);
+  return stats;
+}
+
+suite<> test_baseline("benchmark baselines", [](auto &_) {
+
+  _.test("round trip", []() {
+    test_name sort = {{"suite", "sub\tsuite"}, "sort", 0};
+    test_name find = {{"suite"}, "find", 1};
+
+    bench_baseline baseline;
+    baseline.record(sort, stats_of(1234.5, 6.25));
+    baseline.record(find, stats_of(7, 0.5, 3));
+
+    std::stringstream ss;
+    baseline.write(ss);
+
+    bench_baseline loaded;
+    expect(loaded.read(ss), equal_to(true));
+    expect(loaded.size(), equal_to<size_t>(2));
+
+    bench_stats stats;
+    expect(loaded.find(sort, stats), equal_to(true));
+    expect(stats.samples, equal_to<size_t>(10));
+    expect(stats.iterations, equal_to<size_t>(100));
+    expect(stats.mean.count(), equal_to(1234.5));
+    expect(stats.stddev.count(), equal_to(6.25));
+    expect(stats.max.count(), equal_to(1240.75));
+
+    expect(loaded.find(find, stats), equal_to(true));
+    expect(stats.samples, equal_to<size_t>(3));
+    expect(loaded.find({{"suite"}, "other", 2}, stats), equal_to(false));
+  });
+
+  _.test("round trip with counters", []() {
+    test_name sort = {{"suite"}, "sort", 0};
+    auto counted = stats_of(100, 1);
+    counted.counters.instructions = 412.5;
+    counted.counters.cycles = 150;
+
+    bench_baseline baseline;
+    baseline.record(sort, counted);
+    baseline.record({{"suite"}, "find", 1}, stats_of(7, 0.5));
+
+    std::stringstream ss;
+    baseline.write(ss);
+
+    bench_baseline loaded;
+    expect(loaded.read(ss), equal_to(true));
+    expect(loaded.size(), equal_to<size_t>(2));
+
+    bench_stats stats;
+    expect(loaded.find(sort, stats), equal_to(true));
+    expect(stats.counters.instructions, equal_to(412.5));
+    expect(stats.counters.cycles, equal_to(150.0));
+    expect(stats.counters.llc_misses, equal_to(-1.0));
+
+    expect(loaded.find({{"suite"}, "find", 1}, stats), equal_to(true));
+    expect(stats.counters.available(), equal_to(false));
+
+    std::istringstream orphan("counters\t1\t2\t3\t4\t5\ts\tt\n");
+    expect(loaded.read(orphan), equal_to(false));
+  });
+
+  _.test("bad lines are skipped", []() {
+    std::istringstream in("garbage\nbench\t1\t1\t5\t5\t0\t5\t5\ts\tt\n");
+    bench_baseline baseline;
+    expect(baseline.read(in), equal_to(false));
+    expect(baseline.size(), equal_to<size_t>(1));
+  });
+
+  _.test("significantly_slower()", []() {
+    using detail::significantly_slower;
+    auto base = stats_of(100, 5);
+    expect(significantly_slower(base, stats_of(120, 5)), equal_to(true));
+    expect(significantly_slower(base, stats_of(120, 60)), equal_to(false));
+    expect(significantly_slower(base, stats_of(90, 5)), equal_to(false));
+    expect(significantly_slower(base, stats_of(101, 0, 1)), equal_to(true));
+  });
+
+  _.test("baseline_checker", []() {
+    bench_baseline baseline;
+    baseline.record({{"suite"}, "slow", 0}, stats_of(100, 1));
+    baseline.record({{"suite"}, "same", 1}, stats_of(100, 1));
+    baseline.record({{"suite"}, "noisy", 2}, stats_of(100, 40));
+
+    bench_event_logger log;
+    baseline_checker checker(log, baseline);
+    test_metrics metrics;
+    checker.passed_bench({{"suite"}, "slow", 3}, stats_of(150, 1), metrics);
+    checker.passed_bench({{"suite"}, "same", 4}, stats_of(105, 1), metrics);
+    checker.passed_bench({{"suite"}, "noisy", 5}, stats_of(130, 40), metrics);
+    checker.passed_bench({{"suite"}, "new", 6}, stats_of(500, 1), metrics);
+    checker.passed_test({{"suite"}, "test", 7}, metrics);
+
+    expect(log.events, equal_to(std::vector<std::string>{
+      "failed slow: regressed from 100 ns to 150 ns per iteration (+50.0%)",
+      "passed bench same", "passed bench noisy", "passed bench new",
+      "passed test"
+    }));
+
+    bench_event_logger strict_log;
+    baseline_checker strict(strict_log, baseline, 0.01);
+    strict.passed_bench({{"suite"}, "same", 4}, stats_of(105, 1), metrics);
+    expect(strict_log.events, equal_to(std::vector<std::string>{
+      "failed same: regressed from 100 ns to 105 ns per iteration (+5.0%)"
+    }));
+  });
+
+  _.test("baseline_checker with counters", []() {
+    auto base = stats_of(100, 1);
+    base.counters.instructions = 1000;
+    bench_baseline baseline;
+    baseline.record({{"suite"}, "more", 0}, base);
+    baseline.record({{"suite"}, "same", 1}, base);
+    baseline.record({{"suite"}, "uncounted", 2}, base);
+
+    auto more = stats_of(100, 1), same = stats_of(100, 1);
+    more.counters.instructions = 1500;
+    same.counters.instructions = 1050;
+
+    bench_event_logger log;
+    baseline_checker checker(log, baseline);
+    test_metrics metrics;
+    checker.passed_bench({{"suite"}, "more", 3}, more, metrics);
+    checker.passed_bench({{"suite"}, "same", 4}, same, metrics);
+    checker.passed_bench({{"suite"}, "uncounted", 5}, stats_of(100, 1),
+                         metrics);
+
+    expect(log.events, equal_to(std::vector<std::string>{
+      "failed more: regressed from 1000.0 to 1500.0 instructions per "
+      "iteration (+50.0%)",
+      "passed bench same", "passed bench uncounted"
+    }));
+  });
+
+  _.test("baseline_logger", []() {
+    bench_baseline baseline;
+    baseline_logger log(baseline);
+    test_metrics metrics;
+    log.passed_test({{"suite"}, "test", 0}, metrics);
+    log.passed_bench({{"suite"}, "bench", 1}, stats_of(10, 1), metrics);
+
+    bench_stats stats;
+    expect(baseline.size(), equal_to<size_t>(1));
+    expect(baseline.find({{"suite"}, "bench", 1}, stats), equal_to(true));
+    expect(stats.mean.count(), equal_to(10.0));
+  });
+
+});
@@ -42,6 +42,42 @@ suite<suites_list> test_driver("driver suite declaration", [](auto &_) {
     expect(float_suite.size(), equal_to<size_t>(2));
   });
 
+  _.test("register a test suite", [](suites_list &) {
+    suite_factories factories;
+    size_t built = 0;
+    suite<int, float>("inner test suite", [&built](auto &_){
+      built++;
+      _.test("inner test", [](auto &) {});
+      _.skip_test("skipped test", [](auto &) {});
+    }, factories);
+
+    expect(factories.size(), equal_to<size_t>(2));
+    expect(built, equal_to<size_t>(0));
+
+    auto int_suite = factories[0].make();
+    expect(built, equal_to<size_t>(1));
+    expect(int_suite.name(), equal_to(factories[0].name));
+    expect(int_suite.size(), equal_to<size_t>(2));
+  });
+
+  _.test("only build selected suites", [](suites_list &) {
+    suite_factories factories;
+    std::vector<std::string> built;
+    for(std::string name : {"first", "second"}) {
+      suite<>(name, [&built, name](auto &_){
+        built.push_back(name);
+        _.test("test", []() {});
+      }, factories);
+    }
+
+    test_filter filter;
+    filter.include("second");
+    auto suites = detail::build_suites(factories, filter);
+    expect(suites.size(), equal_to<size_t>(1));
+    expect(suites[0].name(), equal_to("second"));
+    expect(built, equal_to(std::vector<std::string>{"second"}));
+  });
+
   _.test("create a test suite that throws", [](suites_list &suites) {
     try {
       suite<>("broken test suite", [](auto &){
@@ -0,0 +1,73 @@
+#include <mettle.hpp>
+using namespace mettle;
+
+suite<> test_test_filter("test filter", [](auto &_) {
+
+  _.test("empty filter", []() {
+    test_filter filter;
+    expect(filter.empty(), equal_to(true));
+    expect(filter.check_suite({"suite"}), equal_to(true));
+    expect(filter({"suite"}, "test"), equal_to(true));
+  });
+
+  _.test("include", []() {
+    test_filter filter;
+    filter.include("^suite$ > sub");
+    expect(filter.empty(), equal_to(false));
+
+    expect(filter.check_suite({"suite"}), equal_to(true));
+    expect(filter.check_suite({"other"}), equal_to(false));
+    expect(filter.check_suite({"suite", "subsuite"}), equal_to(true));
+    expect(filter.check_suite({"suite", "other"}), equal_to(false));
+    expect(filter.check_suite({"suite", "subsuite", "inner"}), equal_to(true));
+
+    expect(filter({"suite"}, "subtest"), equal_to(true));
+    expect(filter({"suite"}, "test"), equal_to(false));
+    expect(filter({"suite", "subsuite"}, "test"), equal_to(true));
+    expect(filter({"my suite", "subsuite"}, "test"), equal_to(false));
+  });
+
+  _.test("multiple includes", []() {
+    test_filter filter;
+    filter.include("one");
+    filter.include("two > test");
+
+    expect(filter.check_suite({"one"}), equal_to(true));
+    expect(filter.check_suite({"two"}), equal_to(true));
+    expect(filter.check_suite({"three"}), equal_to(false));
+
+    expect(filter({"one"}, "anything"), equal_to(true));
+    expect(filter({"two"}, "my test"), equal_to(true));
+    expect(filter({"two"}, "other"), equal_to(false));
+  });
+
+  _.test("exclude", []() {
+    test_filter filter;
+    filter.exclude("suite > slow");
+    expect(filter.empty(), equal_to(false));
+
+    expect(filter.check_suite({"suite"}), equal_to(true));
+    expect(filter.check_suite({"suite", "slow tests"}), equal_to(false));
+    expect(filter.check_suite({"suite", "fast tests"}), equal_to(true));
+
+    expect(filter({"suite"}, "slow test"), equal_to(false));
+    expect(filter({"suite"}, "fast test"), equal_to(true));
+    expect(filter({"other"}, "slow test"), equal_to(true));
+  });
+
+  _.test("include and exclude", []() {
+    test_filter filter;
+    filter.include("suite");
+    filter.exclude("suite > broken");
+
+    expect(filter({"suite"}, "test"), equal_to(true));
+    expect(filter({"suite"}, "broken test"), equal_to(false));
+    expect(filter({"other"}, "test"), equal_to(false));
+  });
+
+  _.test("invalid pattern", []() {
+    test_filter filter;
+    expect([&filter]() { filter.include("("); }, thrown<std::regex_error>());
+  });
+
+});
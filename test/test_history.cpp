@@ -0,0 +1,229 @@
+#include <mettle.hpp>
+using namespace mettle;
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string temp_history_file() {
+  char path[] = "/tmp/mettle-history-XXXXXX";
+  int fd = mkstemp(path);
+  if(fd < 0)
+    throw std::system_error(errno, std::generic_category());
+  close(fd);
+  unlink(path);
+  return path;
+}
+
+test_metrics metrics_taking(std::chrono::milliseconds wall) {
+  test_metrics metrics;
+  metrics.timing.test.wall = wall;
+  metrics.usage.max_rss = 100;
+  return metrics;
+}
+
+suite<> test_history_store("history store", [](auto &_) {
+
+  _.test("empty", []() {
+    auto path = temp_history_file();
+    history_store store(path);
+    test_history h;
+    expect(store.size(), equal_to(0u));
+    expect(store.find({{"suite"}, "test", 0}, h), equal_to(false));
+  });
+
+  _.test("record and find", []() {
+    auto path = temp_history_file();
+    history_store store(path);
+    test_name name = {{"suite"}, "test", 0};
+    store.record(name, test_outcome::failed,
+                 metrics_taking(std::chrono::milliseconds(10)));
+
+    test_history h;
+    expect(store.find(name, h), equal_to(true));
+    expect(h.runs, equal_to(1u));
+    expect(h.failures, equal_to(1u));
+    expect(h.last_outcome == test_outcome::failed, equal_to(true));
+    expect(h.last_duration, equal_to(std::chrono::milliseconds(10)));
+    expect(h.max_rss, equal_to(100));
+
+    expect(store.find({{"suite"}, "other", 0}, h), equal_to(false));
+    expect(store.find({{}, "suite > test", 0}, h), equal_to(true));
+  });
+
+  _.test("persists across runs", []() {
+    auto path = temp_history_file();
+    test_name name = {{"suite"}, "test", 0};
+
+    for(int i = 0; i != 10; i++) {
+      history_store store(path);
+      store.record(name, i == 9 ? test_outcome::timed_out :
+                   test_outcome::passed,
+                   metrics_taking(std::chrono::milliseconds(i < 5 ? 100 : 20)));
+      expect(store.save(), equal_to(true));
+    }
+
+    history_store store(path);
+    test_history h;
+    expect(store.size(), equal_to(1u));
+    expect(store.find(name, h), equal_to(true));
+    expect(h.runs, equal_to(10u));
+    expect(h.failures, equal_to(1u));
+    expect(h.last_outcome == test_outcome::timed_out, equal_to(true));
+    expect(h.last_duration, equal_to(std::chrono::milliseconds(20)));
+    expect(h.mean_duration, all(
+      greater(std::chrono::milliseconds(20)),
+      less(std::chrono::milliseconds(100))
+    ));
+    unlink(path.c_str());
+  });
+
+  _.test("compacts", []() {
+    auto path = temp_history_file();
+    test_name name = {{"suite"}, "test", 0};
+
+    for(int i = 0; i != 20; i++) {
+      history_store store(path);
+      store.record(name, test_outcome::passed,
+                   metrics_taking(std::chrono::milliseconds(1)));
+      expect(store.save(), equal_to(true));
+
+      struct stat st;
+      stat(path.c_str(), &st);
+      expect(static_cast<size_t>(st.st_size), less_equal(
+        8 + 5 * sizeof(detail::history_record)
+      ));
+    }
+    unlink(path.c_str());
+  });
+
+  _.test("drops a partial record", []() {
+    auto path = temp_history_file();
+    test_name a = {{"suite"}, "a", 0}, b = {{"suite"}, "b", 1};
+    auto ms = std::chrono::milliseconds(1);
+    {
+      history_store store(path);
+      store.record(a, test_outcome::passed, metrics_taking(ms));
+      store.record(b, test_outcome::passed, metrics_taking(ms));
+      expect(store.save(), equal_to(true));
+    }
+    {
+      history_store store(path);
+      store.record(a, test_outcome::passed, metrics_taking(ms));
+      expect(store.save(), equal_to(true));
+    }
+
+    // Cut off the last record partway through, as if a save was interrupted.
+    const size_t full_size = 8 + 3 * sizeof(detail::history_record);
+    expect(truncate(path.c_str(), full_size - 20), equal_to(0));
+    {
+      history_store store(path);
+      expect(store.size(), equal_to(2u));
+      store.record(b, test_outcome::passed, metrics_taking(ms));
+      expect(store.save(), equal_to(true));
+    }
+
+    history_store store(path);
+    test_history h;
+    expect(store.size(), equal_to(2u));
+    expect(store.find(a, h), equal_to(true));
+    expect(h.runs, equal_to(1u));
+    expect(store.find(b, h), equal_to(true));
+    expect(h.runs, equal_to(2u));
+
+    struct stat st;
+    stat(path.c_str(), &st);
+    expect(static_cast<size_t>(st.st_size),
+           equal_to(8 + 2 * sizeof(detail::history_record)));
+    unlink(path.c_str());
+  });
+
+  _.test("ignores unknown versions", []() {
+    auto path = temp_history_file();
+    FILE *f = fopen(path.c_str(), "wb");
+    fputs("MTLH\x7f\x7f\x7f\x7f garbage", f);
+    fclose(f);
+
+    history_store store(path);
+    expect(store.size(), equal_to(0u));
+    store.record({{"suite"}, "test", 0}, test_outcome::passed,
+                 metrics_taking(std::chrono::milliseconds(1)));
+    expect(store.save(), equal_to(true));
+    expect(history_store(path).size(), equal_to(1u));
+    unlink(path.c_str());
+  });
+
+  _.test("longest tests first", []() {
+    auto path = temp_history_file();
+    history_store store(path);
+    test_name fast = {{"suite"}, "fast", 0};
+    test_name slow = {{"suite"}, "slow", 1};
+    test_name medium = {{"suite"}, "medium", 2};
+    test_name unknown = {{"suite"}, "unknown", 3};
+    store.record(fast, test_outcome::passed,
+                 metrics_taking(std::chrono::milliseconds(1)));
+    store.record(slow, test_outcome::passed,
+                 metrics_taking(std::chrono::milliseconds(100)));
+    store.record(medium, test_outcome::passed,
+                 metrics_taking(std::chrono::milliseconds(10)));
+
+    std::vector<test_name> tests = {fast, slow, medium, unknown};
+    std::sort(tests.begin(), tests.end(), history_order(store, false, true));
+    expect(tests, array(unknown, slow, medium, fast));
+  });
+
+  _.test("failed tests first", []() {
+    auto path = temp_history_file();
+    history_store store(path);
+    test_name passed = {{"suite"}, "passed", 0};
+    test_name failed = {{"suite"}, "failed", 1};
+    test_name slow_failed = {{"suite"}, "slow failed", 2};
+    test_name timed_out = {{"suite"}, "timed out", 3};
+    test_name unknown = {{"suite"}, "unknown", 4};
+    store.record(passed, test_outcome::passed,
+                 metrics_taking(std::chrono::milliseconds(100)));
+    store.record(failed, test_outcome::failed,
+                 metrics_taking(std::chrono::milliseconds(1)));
+    store.record(slow_failed, test_outcome::failed,
+                 metrics_taking(std::chrono::milliseconds(10)));
+    store.record(timed_out, test_outcome::timed_out,
+                 metrics_taking(std::chrono::milliseconds(5)));
+
+    std::vector<test_name> tests = {
+      passed, failed, slow_failed, timed_out, unknown
+    };
+    std::stable_sort(tests.begin(), tests.end(),
+                     history_order(store, true, false));
+    expect(tests, array(failed, slow_failed, timed_out, passed, unknown));
+
+    std::stable_sort(tests.begin(), tests.end(),
+                     history_order(store, true, true));
+    expect(tests, array(slow_failed, timed_out, failed, unknown, passed));
+  });
+
+  _.test("logger records outcomes", []() {
+    auto path = temp_history_file();
+    history_store store(path);
+    history_logger log(store);
+    test_name passed = {{"suite"}, "passed", 0};
+    test_name failed = {{"suite"}, "failed", 1};
+    test_name timed_out = {{"suite"}, "timed out", 2};
+    test_name skipped = {{"suite"}, "skipped", 3};
+
+    log.passed_test(passed, metrics_taking(std::chrono::milliseconds(1)));
+    log.failed_test(failed, "message",
+                    metrics_taking(std::chrono::milliseconds(1)));
+    log.timed_out_test(timed_out, std::chrono::milliseconds(50));
+    log.skipped_test(skipped);
+
+    test_history h;
+    expect(store.find(passed, h), equal_to(true));
+    expect(h.last_outcome == test_outcome::passed, equal_to(true));
+    expect(store.find(failed, h), equal_to(true));
+    expect(h.last_outcome == test_outcome::failed, equal_to(true));
+    expect(store.find(timed_out, h), equal_to(true));
+    expect(h.last_outcome == test_outcome::timed_out, equal_to(true));
+    expect(h.last_duration, equal_to(std::chrono::milliseconds(50)));
+    expect(store.find(skipped, h), equal_to(false));
+  });
+
+});
@@ -0,0 +1,41 @@
+#include <mettle.hpp>
+using namespace mettle;
+
+#include <sstream>
+
+suite<> test_loggers("loggers", [](auto &_) {
+  subsuite<>(_, "multi_run_logger", [](auto &_) {
+    auto log_runs = [](bool show_growth) {
+      std::stringstream out;
+      detail::multi_run_logger logger({out, 0}, show_growth);
+
+      test_name name = {{"suite"}, "leaky", 1};
+      test_metrics metrics;
+      metrics.allocations.net_bytes = 512;
+      for(int run = 0; run != 2; run++) {
+        logger.start_run();
+        logger.start_suite({"suite"});
+        logger.start_test(name);
+        logger.passed_test(name, metrics);
+        logger.end_suite({"suite"});
+        logger.end_run();
+      }
+      logger.summarize();
+      return out.str();
+    };
+
+    _.test("memory growth is shown when tests share a process",
+           [log_runs]() {
+      auto summary = log_runs(true);
+      expect(summary.find("left memory behind on every run"),
+             not_equal_to(std::string::npos));
+      expect(summary.find("suite > leaky (per run)"),
+             not_equal_to(std::string::npos));
+    });
+
+    _.test("memory growth isn't shown when tests are forked", [log_runs]() {
+      auto summary = log_runs(false);
+      expect(summary.find("left memory behind"), equal_to(std::string::npos));
+    });
+  });
+});
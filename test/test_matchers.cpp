@@ -1,6 +1,11 @@
 #include <mettle.hpp>
+#include <mettle/allocation_hooks.hpp>
 using namespace mettle;
 
+#include <array>
+#include <cmath>
+#include <functional>
+#include <list>
 #include <stdexcept>
 #include <vector>
 
@@ -17,6 +22,17 @@ T about_one() {
   return value;
 }
 
+inline auto has_suffix(const std::string &suffix) {
+  return make_matcher(
+    suffix,
+    [](const std::string &actual, const std::string &suffix) -> bool {
+      return actual.size() >= suffix.size() &&
+             actual.compare(actual.size() - suffix.size(), std::string::npos,
+                            suffix) == 0;
+    }, "ends with "
+  );
+}
+
 suite<> matcher_tests("test matchers", [](auto &_) {
 
   subsuite<>(_, "basic", [](auto &_) {
@@ -37,6 +53,50 @@ suite<> matcher_tests("test matchers", [](auto &_) {
 
       expect(is_not(123).desc(), equal_to("not 123"));
     });
+
+    _.test("make_matcher() descriptions", []() {
+      auto yes = [](const auto &) { return true; };
+      std::string name = "string";
+      expect(make_matcher(yes, "literal").desc(), equal_to("literal"));
+      expect(make_matcher(yes, name).desc(), equal_to("string"));
+
+      int calls = 0;
+      auto lazy = make_matcher(yes, [&calls]() {
+        calls++;
+        return std::string("lazy");
+      });
+      expect(123, lazy);
+      expect(calls, equal_to(0));
+      expect(lazy.desc(), equal_to("lazy"));
+      expect(calls, equal_to(1));
+
+      auto prefixed = make_matcher(123, std::equal_to<>(), []() {
+        return std::string("is ");
+      });
+      expect(prefixed.desc(), equal_to("is 123"));
+    });
+
+    _.test("passing matchers don't allocate", []() {
+      auto int_thrower = []() { throw 123; };
+      std::vector<int> data = {1, 2, 3};
+
+      // Make sure that allocations are being counted at all.
+      auto hooked = detail::allocation_snapshot::now();
+      ::operator delete(::operator new(1));
+      expect(detail::allocation_snapshot::now().count - hooked.count,
+             equal_to(1));
+
+      auto before = detail::allocation_snapshot::now();
+      expect(123, equal_to(123));
+      expect(123, all(greater(100), less(200), is_not(0)));
+      expect(123, any(1, 2, 123));
+      expect(data, each(greater(0)));
+      expect(data, sorted(std::less<int>()));
+      expect(int_thrower, thrown_raw<int>(123));
+      auto after = detail::allocation_snapshot::now();
+
+      expect(after.count - before.count, equal_to(0));
+    });
   });
 
   subsuite<>(_, "relational", [](auto &_) {
@@ -50,6 +110,29 @@ suite<> matcher_tests("test matchers", [](auto &_) {
       expect(equal_to(123).desc(), equal_to("123"));
     });
 
+    _.test("equal_to() shows a diff", []() {
+      expect([]() {
+        expect(std::vector<int>{1, 2, 3, 4}, equal_to(std::vector<int>{1, 3, 4}));
+      }, thrown<expectation_error>(
+        "expected [1, 3, 4], got [1, 2, 3, 4] "
+        "(first difference at index 1: [1, {+2+}, 3, 4])"
+      ));
+
+      expect([]() {
+        expect(std::string("hello world"), equal_to("hello there"));
+      }, thrown<expectation_error>(
+        "expected \"hello there\", got \"hello world\" "
+        "(first difference at index 6: \"hello [-the-]{+wo+}r[-e-]{+ld+}\")"
+      ));
+
+      // With nothing in common, a diff wouldn't help.
+      expect([]() {
+        expect(std::vector<int>{1, 2}, equal_to(std::vector<int>{3}));
+      }, thrown<expectation_error>("expected [3], got [1, 2]"));
+      expect([]() { expect(1, equal_to(2)); },
+             thrown<expectation_error>("expected 2, got 1"));
+    });
+
     _.test("not_equal_to()", []() {
       expect(true, not_equal_to(false));
       expect(123, not_equal_to(1234));
@@ -114,6 +197,93 @@ suite<> matcher_tests("test matchers", [](auto &_) {
 
       expect(near_to_abs(1.23f, 0.0f).desc(), equal_to("~= 1.23"));
     });
+
+    _.test("near_to_ulp()", []() {
+      float one = 1.0f, next = std::nextafter(one, 2.0f);
+      expect(next, near_to_ulp(one, 1));
+      expect(next, is_not(near_to_ulp(one, 0)));
+      expect(-0.0, near_to_ulp(0.0, 0));
+      expect(std::nextafter(0.0, -1.0), near_to_ulp(std::nextafter(0.0, 1.0), 2));
+      expect(std::nan(""), is_not(near_to_ulp(std::nan(""), 1000)));
+
+      expect(near_to_ulp(1.5, 4).desc(), equal_to("~= 1.5"));
+    });
+
+    _.test("elements_near_to()", []() {
+      std::vector<float> expected(1000);
+      for(size_t i = 0; i != expected.size(); i++)
+        expected[i] = i * 0.5f;
+      auto actual = expected;
+      actual[300] *= 1.000001f;
+
+      expect(actual, elements_near_to(expected, 1e-5f));
+      expect(actual, is_not(elements_near_to(expected, 1e-8f)));
+      expect(actual, elements_near_to_abs(expected, 0.01f));
+      expect(actual, elements_near_to_ulp(expected, 16));
+      expect(actual, is_not(elements_near_to_ulp(expected, 0)));
+
+      std::list<double> list(expected.begin(), expected.end());
+      expect(list, elements_near_to(expected));
+      expect(actual, elements_near_to_abs(list, 0.01));
+
+      expect(std::vector<float>(999), is_not(elements_near_to(expected)));
+      expect(std::list<double>(3), is_not(elements_near_to(expected)));
+
+      expect(elements_near_to(expected, 0.5f).desc(),
+             equal_to("~= 1000 expected elements (relative error <= 0.5)"));
+      expect(elements_near_to_abs(list, 0.25).desc(),
+             equal_to("~= 1000 expected elements (absolute error <= 0.25)"));
+      expect(elements_near_to_ulp(expected, 4).desc(),
+             equal_to("~= 1000 expected elements (within 4 ULPs)"));
+    });
+
+    _.test("elements_near_to() summarizes mismatches", []() {
+      std::vector<double> expected(200, 1.0), actual(200, 1.0);
+      actual[70] = 1.5;
+      actual[150] = 3.0;
+      actual[199] = 2.0;
+
+      auto message = [](const auto &actual, const auto &matcher) {
+        match_result result = matcher(actual);
+        return result.message;
+      };
+      std::string summary = "3 of 200 elements differ; first at index 70: "
+                            "1.5 vs 1; worst at index 150: 3 vs 1 (error 2)";
+      expect(message(actual, elements_near_to_abs(expected, 0.1)),
+             equal_to(summary));
+
+      std::list<double> list(actual.begin(), actual.end());
+      expect(message(list, elements_near_to_abs(expected, 0.1)),
+             equal_to(summary));
+
+      actual[10] = std::nan("");
+      expect(message(actual, elements_near_to(expected)),
+             has_suffix("worst at index 10: nan vs 1 (error nan)"));
+
+      expect(message(std::vector<double>(3), elements_near_to(expected)),
+             equal_to("3 elements instead of 200"));
+      expect(message(std::list<double>(201), elements_near_to(expected)),
+             equal_to("201 elements instead of 200"));
+    });
+
+    _.test("elements_near_to() copies its range unless given std::ref", []() {
+      auto matcher = [] {
+        std::vector<double> expected(3, 1.0);
+        return elements_near_to(expected);
+      }();
+      expect(std::vector<double>(3, 1.0), matcher);
+
+      const double array[] = {1.0, 2.0};
+      expect(std::vector<double>{1.0, 2.0}, elements_near_to(array));
+
+      std::vector<double> expected(3, 1.0);
+      auto by_ref = elements_near_to_abs(std::ref(expected), 0.1);
+      expected[1] = 2.0;
+      expect(std::vector<double>{1.0, 2.0, 1.0}, by_ref);
+      expect(std::vector<double>(3, 1.0), is_not(by_ref));
+      expect(std::list<double>{1.0, 2.0, 1.0},
+             elements_near_to_ulp(std::cref(expected), 0));
+    });
   });
 
   subsuite<>(_, "combinatoric", [](auto &_) {
@@ -167,6 +337,19 @@ suite<> matcher_tests("test matchers", [](auto &_) {
       expect(member(123).desc(), equal_to("member 123"));
     });
 
+    _.test("member() over many numbers", []() {
+      std::vector<float> data(1000, 1.5f);
+      expect(data, is_not(member(greater(2))));
+      data[999] = 2.5f;
+      expect(data, member(greater(2)));
+      data[130] = 3.5f;
+      expect(data, member(3.5f));
+
+      std::array<unsigned char, 3> bytes = {{1, 2, 3}};
+      expect(bytes, member(less_equal(1)));
+      expect(bytes, is_not(member(0)));
+    });
+
     _.test("each()", []() {
       expect(std::vector<int>{}, each( is_not(anything()) ));
       expect(std::vector<int>{1, 2, 3}, each( greater(0)) );
@@ -179,6 +362,97 @@ suite<> matcher_tests("test matchers", [](auto &_) {
       expect(each(123).desc(), equal_to("each 123"));
     });
 
+    _.test("each() over many numbers", []() {
+      using detail::is_fast_range_match;
+      expect(is_fast_range_match<
+        std::vector<int>, decltype(less(1))
+      >::value, equal_to(true));
+      expect(is_fast_range_match<
+        int[3], decltype(greater(1.5))
+      >::value, equal_to(true));
+      expect(is_fast_range_match<
+        std::vector<int>, decltype(is_not(1))
+      >::value, equal_to(false));
+      expect(is_fast_range_match<
+        std::vector<bool>, decltype(equal_to(true))
+      >::value, equal_to(false));
+
+      std::vector<int> data(1000);
+      for(size_t i = 0; i != data.size(); i++)
+        data[i] = i;
+      expect(data, each(less(1000)));
+      expect(data, each(greater_equal(0.0)));
+      expect(data, is_not(each(less(999))));
+      expect(data, is_not(each(not_equal_to(500))));
+
+      std::vector<double> nans(100, std::nan(""));
+      expect(nans, is_not(each(equal_to(nans[0]))));
+      expect(nans, each(not_equal_to(nans[0])));
+    });
+
+    _.test("each() reports the first mismatch", []() {
+      std::vector<int> data(200, 1);
+      data[150] = 7;
+      data[180] = 9;
+      expect([&data]() { expect(data, each(less(5))); },
+             thrown<expectation_error>(
+               has_suffix("(first mismatch at index 150: 7)")
+             ));
+
+      std::vector<std::string> words = {"a", "b", "c"};
+      expect([&words]() { expect(words, each(is_not("b"))); },
+             thrown<expectation_error>(
+               "expected each not \"b\", got [\"a\", \"b\", \"c\"] "
+               "(first mismatch at index 1: \"b\")"
+             ));
+
+      std::vector<std::vector<int>> nested = {{1}, {2, 3}};
+      expect([&nested]() { expect(nested, each(each(less(3)))); },
+             thrown<expectation_error>(has_suffix(
+               "(first mismatch at index 1: [2, 3] "
+               "(first mismatch at index 1: 3))"
+             )));
+    });
+
+    _.test("expect_each()", []() {
+      std::vector<int> data(200, 1);
+      expect_each(data, less(5));
+      expect_each(std::list<int>(data.begin(), data.end()), less(5));
+
+      data[150] = 7;
+      data[180] = 9;
+      expect([&data]() { expect_each(data, less(5)); },
+             thrown<expectation_error>(
+               "expected each < 5, but 2 of 200 elements didn't match "
+               "(index 150: 7; index 180: 9)"
+             ));
+      expect([&data]() { expect_each(data, less(5), 1); },
+             thrown<expectation_error>(
+               "expected each < 5, but 2 of 200 elements didn't match "
+               "(index 150: 7; ... 1 more)"
+             ));
+      expect([&data]() { expect_each(data, greater(5), 3); },
+             thrown<expectation_error>(
+               "expected each > 5, but 198 of 200 elements didn't match "
+               "(index 0: 1; index 1: 1; index 2: 1; ... 195 more)"
+             ));
+
+      std::list<int> list(data.begin(), data.end());
+      expect([&list]() { expect_each(list, less(5), 0); },
+             thrown<expectation_error>(
+               "expected each < 5, but 2 of 200 elements didn't match "
+               "(... 2 more)"
+             ));
+
+      std::vector<std::vector<int>> nested = {{1}, {2, 3}, {4}};
+      expect([&nested]() { expect_each(nested, each(less(3))); },
+             thrown<expectation_error>(
+               "expected each each < 3, but 2 of 3 elements didn't match "
+               "(index 1: [2, 3] (first mismatch at index 1: 3); "
+               "index 2: [4] (first mismatch at index 0: 4))"
+             ));
+    });
+
     _.test("array()", []() {
       expect(std::vector<int>{}, array());
       expect(std::vector<int>{1, 2, 3}, array(1, 2, 3));
@@ -4,6 +4,8 @@ using namespace mettle;
 #include <vector>
 #include <list>
 
+#include <mettle/diff.hpp>
+
 template<typename T>
 std::string stringify(T &&t) {
   std::stringstream s;
@@ -18,6 +20,19 @@ namespace my_namespace {
 
 void sample_function(void) {}
 
+class scoped_print_limits {
+public:
+  scoped_print_limits(const print_limits &limits)
+    : old_(current_print_limits()) {
+    current_print_limits() = limits;
+  }
+  ~scoped_print_limits() {
+    current_print_limits() = old_;
+  }
+private:
+  print_limits old_;
+};
+
 suite<> output("debug output", [](auto &_){
   subsuite<>(_, "ensure_printable()", [](auto &_) {
     _.test("primitives", []() {
@@ -28,6 +43,8 @@ suite<> output("debug output", [](auto &_){
       expect(stringify(nullptr), equal_to("nullptr"));
       expect(stringify("text"), equal_to("\"text\""));
       expect(stringify(std::string("text")), equal_to("\"text\""));
+      expect(stringify(std::string("\"a\\b\"\n\t\x1b\0", 9)),
+             equal_to("\"\\\"a\\\\b\\\"\\n\\t\\x1b\\x00\""));
     });
 
     _.test("iterables", []() {
@@ -100,6 +117,59 @@ suite<> output("debug output", [](auto &_){
                equal_to("[[\"foo\"], [1, 2], [1, 2, 3]]"));
     });
 
+    _.test("limits", []() {
+      auto big = stringify(std::vector<int>(1000));
+      expect(big.substr(big.size() - 18), equal_to(", 0, ... 900 more]"));
+
+      print_limits limits;
+      limits.elements = 2;
+      limits.depth = 2;
+      limits.bytes = 20;
+      scoped_print_limits scoped(limits);
+
+      expect(stringify(std::vector<int>{1, 2}), equal_to("[1, 2]"));
+      expect(stringify(std::vector<int>{1, 2, 3}),
+             equal_to("[1, 2, ... 1 more]"));
+      expect(stringify(std::list<int>{1, 2, 3, 4}),
+             equal_to("[1, 2, ... 2 more]"));
+      expect(stringify(std::make_tuple(1, 2, 3)),
+             equal_to("[1, 2, ... 1 more]"));
+
+      using nested = std::vector<std::vector<std::vector<int>>>;
+      expect(stringify(nested{{{1}}, {}}), equal_to("[[[...]], []]"));
+      expect(stringify(std::make_tuple(std::make_tuple(std::make_tuple()))),
+             equal_to("[[[...]]]"));
+
+      std::vector<std::string> words = {"a long string", "another one",
+                                        "and more"};
+      expect(stringify(words),
+             equal_to("[\"a long string\", \"an\"... 9 more bytes, "
+                      "... 1 more]"));
+      limits.elements = 100;
+      current_print_limits() = limits;
+      expect(stringify(words),
+             equal_to("[\"a long string\", \"an\"... 9 more bytes, "
+                      "... 1 more]"));
+
+      // Strings are cut off too, whether on their own or inside a collection.
+      expect(stringify(std::string("short")), equal_to("\"short\""));
+      std::string huge(4 * 1024 * 1024, 'x');
+      expect(stringify(huge), equal_to(
+        "\"" + std::string(20, 'x') + "\"... 4194284 more bytes"
+      ));
+      expect(stringify(huge.c_str()), equal_to(
+        "\"" + std::string(20, 'x') + "\"... 4194284 more bytes"
+      ));
+      expect(stringify(std::vector<std::string>{"a", huge}), equal_to(
+        "[\"a\", \"" + std::string(14, 'x') + "\"... 4194290 more bytes]"
+      ));
+
+      // Nested collections share the byte limit of the outermost one.
+      using vec_vec = std::vector<std::vector<int>>;
+      expect(stringify(vec_vec{{10000, 20000, 30000, 40000}, {1, 2}}),
+             equal_to("[[10000, 20000, 30000, ... 1 more], ... 1 more]"));
+    });
+
     _.test("callables", []() {
       auto not_boolean = is_not(any("true", "1"));
 
@@ -117,6 +187,105 @@ suite<> output("debug output", [](auto &_){
     });
   });
 
+  subsuite<>(_, "diff_values()", [](auto &_) {
+    using detail::diff_values;
+
+    _.test("sequences", []() {
+      std::vector<int> a = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+      std::vector<int> b = {1, 2, 3, 4, 0, 6, 7, 8, 9, 10};
+      expect(diff_values(a, b), equal_to(
+        "first difference at index 4: [..., 3, 4, [-5-], {+0+}, 6, 7, 8, "
+        "9, {+10+}]"
+      ));
+      expect(diff_values(std::list<int>{2, 3}, std::vector<int>{1, 2, 3}),
+             equal_to("first difference at index 0: [{+1+}, 2, 3]"));
+      expect(diff_values(a, std::vector<int>{}), equal_to(""));
+    });
+
+    _.test("strings", []() {
+      expect(diff_values(std::string("kitten"), "sitting"), equal_to(
+        "first difference at index 0: \"[-k-]{+s+}itt[-e-]{+i+}n{+g+}\""
+      ));
+      expect(diff_values("abc", "xyz"), equal_to(""));
+      expect(diff_values(std::string("a\"b\0", 4), "a\nb\x1b"), equal_to(
+        "first difference at index 1: "
+        "\"a[-\\\"-]{+\\n+}b[-\\x00-]{+\\x1b+}\""
+      ));
+    });
+
+    _.test("shortest edit script", []() {
+      // Check the edits against a brute-force LCS for lots of small inputs.
+      std::vector<std::string> words = {
+        "", "a", "ab", "abc", "abcabba", "cbabac", "aaaa", "baab", "abba"
+      };
+      for(const auto &a : words) {
+        for(const auto &b : words) {
+          auto diff = detail::make_sequence_diff([&](size_t i, size_t j) {
+            return a[i] == b[j];
+          }, 1000);
+          expect(diff.run(a.size(), b.size()), equal_to(true));
+
+          std::string old_side, new_side;
+          size_t edits = 0;
+          for(const auto &e : diff.edits()) {
+            if(e.kind != detail::edit_kind::insert)
+              old_side += a.substr(e.start, e.length);
+            if(e.kind == detail::edit_kind::keep)
+              new_side += a.substr(e.start, e.length);
+            else
+              edits += e.length;
+            if(e.kind == detail::edit_kind::insert)
+              new_side += b.substr(e.start, e.length);
+          }
+          expect(old_side, equal_to(a));
+          expect(new_side, equal_to(b));
+
+          std::vector<std::vector<size_t>> lcs(
+            a.size() + 1, std::vector<size_t>(b.size() + 1)
+          );
+          for(size_t i = a.size(); i-- != 0;) {
+            for(size_t j = b.size(); j-- != 0;) {
+              lcs[i][j] = a[i] == b[j] ? lcs[i + 1][j + 1] + 1 :
+                          std::max(lcs[i + 1][j], lcs[i][j + 1]);
+            }
+          }
+          expect(edits, equal_to(a.size() + b.size() - 2 * lcs[0][0]));
+        }
+      }
+    });
+
+    _.test("limits", []() {
+      std::vector<int> a(100000), b;
+      for(size_t i = 0; i != a.size(); i++)
+        a[i] = i;
+      b = a;
+      b[50000] = -1;
+      expect(diff_values(a, b), equal_to(
+        "first difference at index 50000: [..., 49998, 49999, [-50000-], "
+        "{+-1+}, 50001, 50002, ...]"
+      ));
+
+      for(size_t i = 0; i != b.size(); i++)
+        b[i] = (i * 7919) % a.size();
+      {
+        print_limits limits;
+        limits.diff_cost = 1000;
+        scoped_print_limits scoped(limits);
+        expect(diff_values(a, b), equal_to("too many differences to diff"));
+      }
+
+      std::vector<int> c(1000, 1);
+      {
+        print_limits limits;
+        limits.bytes = 20;
+        scoped_print_limits scoped(limits);
+        auto diff = diff_values(std::vector<int>{1}, c);
+        expect(diff.size(), less(100u));
+        expect(diff.substr(diff.size() - 8), equal_to(", ...+}]"));
+      }
+    });
+  });
+
   subsuite<>(_, "type_name()", [](auto &_) {
     _.test("primitives", []() {
       expect(type_name<int>(), equal_to("int"));
@@ -0,0 +1,115 @@
+#include <mettle.hpp>
+using namespace mettle;
+
+#include <unistd.h>
+
+std::string written_result(const test_result &result) {
+  int pipefd[2];
+  if(pipe(pipefd) < 0)
+    throw std::system_error(errno, std::generic_category());
+
+  if(fork() == 0) {
+    close(pipefd[0]);
+    detail::write_result(pipefd[1], result);
+    exit(0);
+  }
+  close(pipefd[1]);
+
+  std::string data;
+  char buf[BUFSIZ];
+  ssize_t size;
+  while((size = read(pipefd[0], buf, sizeof(buf))) > 0)
+    data.append(buf, size);
+  close(pipefd[0]);
+  wait(nullptr);
+  return data;
+}
+
+suite<> test_protocol("result protocol", [](auto &_) {
+
+  _.test("round trip", []() {
+    test_result result = { false, "failure message" };
+    result.metrics.timing.test.wall = std::chrono::nanoseconds(123);
+    result.metrics.usage.minor_faults = 4;
+    result.metrics.allocations.net_bytes = 16;
+    result.bench.samples = 8;
+    result.metrics.counters.instructions = 1024;
+    auto data = written_result(result);
+
+    detail::frame_reader reader;
+    expect(reader.feed(data.data(), data.size()), equal_to(data.size()));
+    expect(reader.done(), equal_to(true));
+    expect(reader.result().passed, equal_to(false));
+    expect(reader.result().message, equal_to("failure message"));
+    expect(reader.result().metrics.timing.test.wall.count(), equal_to(123));
+    expect(reader.result().metrics.usage.minor_faults, equal_to(4));
+    expect(reader.result().metrics.allocations.net_bytes, equal_to(16));
+    expect(reader.result().bench.samples, equal_to<size_t>(8));
+    expect(reader.result().metrics.counters.instructions, equal_to(1024.0));
+    expect(reader.result().metrics.counters.cycles, equal_to(-1.0));
+  });
+
+  _.test("byte at a time", []() {
+    auto data = written_result({ true, "" });
+
+    detail::frame_reader reader;
+    for(size_t i = 0; i != data.size(); i++) {
+      expect(reader.done(), equal_to(false));
+      reader.feed(data.data() + i, 1);
+    }
+    expect(reader.done(), equal_to(true));
+    expect(reader.result().passed, equal_to(true));
+    expect(reader.result().message, equal_to(""));
+  });
+
+  _.test("stops after end frame", []() {
+    auto data = written_result({ true, "first" });
+    auto second = written_result({ false, "second" });
+
+    detail::frame_reader reader;
+    expect(reader.feed((data + second).data(), data.size() + second.size()),
+           equal_to(data.size()));
+    expect(reader.result().message, equal_to("first"));
+
+    reader.reset();
+    reader.feed(second.data(), second.size());
+    expect(reader.done(), equal_to(true));
+    expect(reader.result().message, equal_to("second"));
+  });
+
+  _.test("incomplete result", []() {
+    auto data = written_result({ true, "message" });
+
+    detail::frame_reader reader;
+    reader.feed(data.data(), data.size() - 1);
+    expect(reader.done(), equal_to(false));
+  });
+
+  _.test("long messages are truncated", []() {
+    std::string message(detail::max_message_size + 10, 'x');
+    auto data = written_result({ false, message });
+
+    detail::frame_reader reader;
+    reader.feed(data.data(), data.size());
+    expect(reader.done(), equal_to(true));
+    expect(reader.result().message.size(),
+           equal_to(detail::max_message_size));
+  });
+
+  _.test("long messages are received from a forked test", []() {
+    auto s = make_suite<>("inner", [](auto &_){
+      _.test("test", []() {
+        // This only changes the limits in the forked child.
+        current_print_limits().bytes = 1024 * 1024;
+        expect(std::string(200000, 'x'), equal_to("y"));
+      });
+    });
+
+    for(const auto &t : s) {
+      auto result = detail::run_test(t.function);
+      expect(result.passed, equal_to(false));
+      expect(result.message.size(), greater(200000));
+    }
+  });
+
+});
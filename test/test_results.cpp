@@ -0,0 +1,136 @@
+#include <mettle.hpp>
+using namespace mettle;
+
+#include <sstream>
+
+struct event_logger : test_logger {
+  void start_run() {}
+  void end_run() {}
+
+  void start_suite(const std::vector<std::string> &suites) {
+    events.push_back("start " + join(suites));
+  }
+  void end_suite(const std::vector<std::string> &suites) {
+    events.push_back("end " + join(suites));
+  }
+
+  void start_test(const test_name &) {}
+  void passed_test(const test_name &test, const test_metrics &metrics) {
+    events.push_back("passed " + test.test + " " +
+                     std::to_string(metrics.timing.test.wall.count()));
+  }
+  void skipped_test(const test_name &test) {
+    events.push_back("skipped " + test.test);
+  }
+  void failed_test(const test_name &test, const std::string &message,
+                   const test_metrics &) {
+    events.push_back("failed " + test.test + ": " + message);
+  }
+  void timed_out_test(const test_name &test,
+                      std::chrono::milliseconds elapsed) {
+    events.push_back("timed out " + test.test + " " +
+                     std::to_string(elapsed.count()));
+  }
+
+  static std::string join(const std::vector<std::string> &suites) {
+    std::string result;
+    for(const auto &i : suites)
+      result += (result.empty() ? "" : "/") + i;
+    return result;
+  }
+
+  std::vector<std::string> events;
+};
+
+suite<> test_results("results file", [](auto &_) {
+
+  _.test("escape_field()", []() {
+    expect(detail::escape_field("plain"), equal_to("plain"));
+    expect(detail::escape_field("a\tb\nc\rd\\e"),
+           equal_to("a\\tb\\nc\\rd\\\\e"));
+  });
+
+  _.test("results_logger", []() {
+    std::ostringstream ss;
+    results_logger log(ss, 1, 4);
+    test_name passed = {{"suite", "sub"}, "passed", 0};
+    test_name failed = {{"suite"}, "failed", 1};
+    test_name skipped = {{"suite"}, "skipped", 2};
+    test_name timed_out = {{"suite"}, "timed out", 3};
+
+    test_metrics metrics;
+    metrics.timing.setup.wall = std::chrono::nanoseconds(1);
+    metrics.timing.test.wall = std::chrono::nanoseconds(2);
+    metrics.timing.test.cpu = std::chrono::nanoseconds(3);
+    metrics.usage.max_rss = 4;
+
+    log.start_run();
+    log.start_suite(passed.suites);
+    log.start_test(passed);
+    log.passed_test(passed, metrics);
+    log.end_suite(passed.suites);
+    log.start_suite(failed.suites);
+    log.start_test(failed);
+    log.failed_test(failed, "bad\tthings", metrics);
+    log.start_test(skipped);
+    log.skipped_test(skipped);
+    log.start_test(timed_out);
+    log.timed_out_test(timed_out, std::chrono::milliseconds(5));
+    log.end_suite(failed.suites);
+    log.end_run();
+
+    std::vector<std::string> lines;
+    std::istringstream in(ss.str());
+    for(std::string line; std::getline(in, line);)
+      lines.push_back(line);
+
+    expect(lines.size(), equal_to(6u));
+    expect(lines[0], equal_to("run\t2\t4"));
+    expect(lines[1], equal_to("test\tpassed\t3\t3\t4\t\tsuite\tsub\tpassed"));
+    expect(lines[2],
+           equal_to("test\tfailed\t3\t3\t4\tbad\\tthings\tsuite\tfailed"));
+    expect(lines[3], equal_to("test\tskipped\t0\t0\t0\t\tsuite\tskipped"));
+    expect(lines[4],
+           equal_to("test\ttimed_out\t5000000\t0\t0\t\tsuite\ttimed out"));
+    expect(lines[5].find("summary\t4\t1\t1\t1\t1\t"), equal_to(0u));
+  });
+
+  _.test("results_reader", []() {
+    std::string data =
+      "run\t1\t1\n"
+      "test\tpassed\t3\t3\t4\t\tsuite\tsub\tpassed\n"
+      "test\tfailed\t3\t3\t4\tbad\\tthings\tsuite\tfailed\n"
+      "test\tskipped\t0\t0\t0\t\tsuite\tskipped\n"
+      "garbage\n"
+      "test\ttimed_out\t5000000\t0\t0\t\tsuite\ttimed out\n"
+      "summary\t4\t1\t1\t1\t1\t100\n";
+
+    event_logger log;
+    results_reader reader(log, {"binary"});
+    // Feed the data a few bytes at a time to make sure we handle partial
+    // lines.
+    for(size_t i = 0; i < data.size(); i += 7)
+      reader.feed(data.data() + i, std::min<size_t>(7, data.size() - i));
+    expect(reader.done(), equal_to(true));
+    reader.finish();
+
+    expect(log.events, equal_to(std::vector<std::string>{
+      "start binary/suite/sub", "passed passed 3", "end binary/suite/sub",
+      "start binary/suite", "failed failed: bad\tthings", "skipped skipped",
+      "timed out timed out 5", "end binary/suite"
+    }));
+  });
+
+  _.test("incomplete results", []() {
+    event_logger log;
+    results_reader reader(log);
+    std::string data = "run\t1\t1\ntest\tpassed\t0\t0\t0\t\tsuite\ttest\n";
+    reader.feed(data.data(), data.size());
+    expect(reader.done(), equal_to(false));
+    reader.finish();
+    expect(log.events, equal_to(std::vector<std::string>{
+      "start suite", "passed test 0", "end suite"
+    }));
+  });
+
+});
@@ -1,6 +1,12 @@
 #include <mettle.hpp>
+#include <mettle/allocation_hooks.hpp>
 using namespace mettle;
 
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <ctime>
+
 struct my_test_logger : test_logger {
   my_test_logger() : tests_run(0) {}
 
@@ -13,13 +19,52 @@ struct my_test_logger : test_logger {
   virtual void start_test(const test_name &) {
     tests_run++;
   }
-  virtual void passed_test(const test_name &) {}
+  virtual void passed_test(const test_name &, const test_metrics &) {}
   virtual void skipped_test(const test_name &) {}
-  virtual void failed_test(const test_name &,
-                           const std::string &) {}
+  virtual void failed_test(const test_name &, const std::string &,
+                           const test_metrics &) {}
+  virtual void timed_out_test(const test_name &,
+                              std::chrono::milliseconds) {}
   size_t tests_run;
 };
 
+struct recording_logger : test_logger {
+  virtual void start_run() {}
+  virtual void end_run() {}
+
+  virtual void start_suite(const std::vector<std::string> &suites) {
+    events.push_back("start " + suites.back());
+  }
+  virtual void end_suite(const std::vector<std::string> &suites) {
+    events.push_back("end " + suites.back());
+  }
+
+  virtual void start_test(const test_name &) {}
+  virtual void passed_test(const test_name &test, const test_metrics &) {
+    events.push_back("passed " + test.test);
+  }
+  virtual void skipped_test(const test_name &test) {
+    events.push_back("skipped " + test.test);
+  }
+  virtual void failed_test(const test_name &test, const std::string &,
+                           const test_metrics &) {
+    events.push_back("failed " + test.test);
+  }
+  virtual void timed_out_test(const test_name &test,
+                              std::chrono::milliseconds elapsed) {
+    events.push_back("timed out " + test.test);
+    timeouts.push_back(elapsed);
+  }
+  virtual void passed_bench(const test_name &test, const bench_stats &stats,
+                            const test_metrics &) {
+    events.push_back("passed bench " + test.test);
+    benches.push_back(stats);
+  }
+  std::vector<std::string> events;
+  std::vector<std::chrono::milliseconds> timeouts;
+  std::vector<bench_stats> benches;
+};
+
 suite<> test_runner("test runner", [](auto &_) {
 
   subsuite<>(_, "run_test()", [](auto &_) {
@@ -76,6 +121,276 @@ suite<> test_runner("test runner", [](auto &_) {
         expect(result.message, equal_to(strsignal(SIGABRT)));
       }
     });
+
+    _.test("resource usage", []() {
+      using namespace std::chrono;
+      const size_t size = 64 * 1024 * 1024;
+      // Write to every page through a volatile pointer so that the optimizer
+      // can't get rid of the memory.
+      auto touch = [size]() {
+        std::unique_ptr<char[]> data(new char[size]);
+        volatile char *p = data.get();
+        for(size_t i = 0; i < size; i += 1024)
+          p[i] = 1;
+        return data;
+      };
+
+      auto s = make_suite<>("inner", [touch](auto &_){
+        _.test("memory", [touch]() {
+          touch();
+        });
+        _.test("cpu", []() {
+          // Spin on CPU time rather than wall time, so that this still uses
+          // enough CPU on a busy machine.
+          auto start = std::clock();
+          while(std::clock() - start < CLOCKS_PER_SEC / 20) {}
+        });
+        _.test("crash", [touch]() {
+          auto data = touch();
+          abort();
+        });
+      });
+
+      std::vector<test_result> results;
+      for(const auto &t : s)
+        results.push_back(detail::run_test(t.function));
+
+      expect(results[0].passed, equal_to(true));
+      expect(results[0].metrics.usage.max_rss,
+             greater_equal(static_cast<long>(size / 1024)));
+      expect(results[0].metrics.usage.minor_faults, greater(0));
+
+      expect(results[1].passed, equal_to(true));
+      const auto &cpu = results[1].metrics.usage;
+      expect(cpu.user + cpu.system, greater_equal(milliseconds(25)));
+
+      expect(results[2].passed, equal_to(false));
+      expect(results[2].metrics.usage.max_rss,
+             greater_equal(static_cast<long>(size / 1024)));
+    });
+
+    _.test("heap allocations", []() {
+      char *leaked = nullptr;
+      auto s = make_suite<>("inner", [&leaked](auto &_){
+        _.test("balanced", []() {
+          std::vector<int> data(1000);
+        });
+        _.test("leaky", [&leaked]() {
+          leaked = new char[512];
+        });
+      });
+
+      // Run each test once here and once in a child process.
+      std::vector<test_result> results;
+      for(const auto &t : s)
+        results.push_back(t.function());
+      for(const auto &t : s)
+        results.push_back(detail::run_test(t.function));
+      delete[] leaked;
+
+      for(size_t i = 0; i != results.size(); i += 2) {
+        const auto &balanced = results[i].metrics.allocations;
+        expect(balanced.count, equal_to(1));
+        expect(balanced.frees, equal_to(1));
+        expect(balanced.bytes, equal_to(1000 * sizeof(int)));
+        expect(balanced.net_bytes, equal_to(0));
+
+        const auto &leaky = results[i + 1].metrics.allocations;
+        expect(leaky.count, equal_to(1));
+        expect(leaky.frees, equal_to(0));
+        expect(leaky.bytes, equal_to(512));
+        expect(leaky.net_bytes, equal_to(512));
+      }
+    });
+
+    _.test("hardware counters", []() {
+      auto s = make_suite<>("inner", [](auto &_){
+        _.test("test", []() {
+          volatile int sum = 0;
+          for(int i = 0; i != 10000; i++)
+            sum += i;
+        });
+      });
+
+      // Counters may not be allowed here (e.g. in a VM); if so, every count
+      // should just be unavailable.
+      bool available = detail::counter_group().available();
+      for(const auto &t : s) {
+        auto uncounted = detail::run_test(t.function);
+        expect(uncounted.metrics.counters.available(), equal_to(false));
+
+        auto counted = detail::run_test(t.function, true);
+        expect(counted.metrics.counters.available(), equal_to(available));
+        if(available) {
+          expect(counted.metrics.counters.instructions,
+                 any(greater(10000.0), equal_to(-1.0)));
+        }
+      }
+    });
+  });
+
+  subsuite<>(_, "worker pool", [](auto &_) {
+    _.test("workers are reused", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        for(int i = 0; i < 4; i++) {
+          _.test("test " + std::to_string(i), []() {
+            static int runs = 0;
+            expect(runs++, equal_to(0));
+          });
+        }
+      });
+
+      run_options options;
+      options.worker_pool = true;
+      recording_logger log;
+      run_tests(s, log, options);
+      expect(log.events, array(
+        "start inner", "passed test 0", "failed test 1", "failed test 2",
+        "failed test 3", "end inner"
+      ));
+    });
+
+    _.test("crashed workers are replaced", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        _.test("test 1", []() {});
+        _.test("test 2", []() {
+          abort();
+        });
+        _.test("test 3", []() {
+          expect(true, equal_to(false));
+        });
+        _.test("test 4", []() {
+          int *x = nullptr;
+          *x = 0;
+        });
+        _.test("test 5", []() {});
+      });
+
+      run_options options;
+      options.worker_pool = true;
+      options.jobs = 2;
+      recording_logger log;
+      run_tests(s, log, options);
+      expect(log.events, array(
+        "start inner", "passed test 1", "failed test 2", "failed test 3",
+        "failed test 4", "passed test 5", "end inner"
+      ));
+    });
+  });
+
+  subsuite<>(_, "timeouts", [](auto &_) {
+    using std::chrono::milliseconds;
+
+    auto make_hanging_suites = []() {
+      return make_suites<>("inner", [](auto &_){
+        _.test("hangs", []() {
+          // Leave a grandchild behind to make sure it gets cleaned up too.
+          if(fork() == 0)
+            pause();
+          pause();
+        });
+        _.test("fast", []() {}, milliseconds(5000));
+        _.test("slow", []() {
+          usleep(500000);
+        }, milliseconds(50));
+      });
+    };
+
+    _.test("only tests that can time out get their own process group", []() {
+      pid_t group = getpgrp();
+      auto s = make_suites<>("inner", [group](auto &_){
+        _.test("shared", [group]() {
+          expect(getpgrp(), equal_to(group));
+        });
+      });
+      auto timed = make_suites<>("inner", [](auto &_){
+        _.test("own", []() {
+          expect(getpgrp(), equal_to(getpid()));
+        }, milliseconds(5000));
+      });
+
+      for(bool worker_pool : {false, true}) {
+        run_options options;
+        options.worker_pool = worker_pool;
+        recording_logger log;
+        run_tests(s, log, options);
+        expect(log.events, array("start inner", "passed shared", "end inner"));
+
+        recording_logger timed_log;
+        run_tests(timed, timed_log, options);
+        expect(timed_log.events, array("start inner", "passed own",
+                                       "end inner"));
+      }
+    });
+
+    _.test("forked tests time out", [make_hanging_suites]() {
+      run_options options;
+      options.timeout = milliseconds(50);
+      options.jobs = 2;
+      recording_logger log;
+      run_tests(make_hanging_suites(), log, options);
+      expect(log.events, array(
+        "start inner", "timed out hangs", "passed fast", "timed out slow",
+        "end inner"
+      ));
+      expect(log.timeouts, each(all( greater_equal(milliseconds(50)),
+                                     less(milliseconds(500)) )));
+    });
+
+    _.test("pooled tests time out", [make_hanging_suites]() {
+      run_options options;
+      options.timeout = milliseconds(50);
+      options.worker_pool = true;
+      recording_logger log;
+      run_tests(make_hanging_suites(), log, options);
+      expect(log.events, array(
+        "start inner", "timed out hangs", "passed fast", "timed out slow",
+        "end inner"
+      ));
+    });
+
+    _.test("pooled tests that keep writing time out", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        _.test("streams", []() {
+          // Find the socket back to the pool (the one our parent made). Start
+          // a huge frame of an unknown type, and then have a few processes
+          // stream bytes into it, so that there's always something to read.
+          int fd = -1;
+          for(int i = 3; i != 256 && fd < 0; i++) {
+            struct stat st;
+            ucred cred;
+            socklen_t len = sizeof(cred);
+            if(fstat(i, &st) == 0 && S_ISSOCK(st.st_mode) &&
+               getsockopt(i, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+               cred.pid == getppid())
+              fd = i;
+          }
+
+          char header[detail::frame_header_size] = {char(200)};
+          std::memset(header + 1, 0xff, sizeof(header) - 1);
+          detail::write_all(fd, header, sizeof(header));
+          for(int i = 0; i != 3; i++) {
+            if(fork() == 0)
+              break;
+          }
+
+          std::string junk(detail::max_frame_size, 'x');
+          auto until = std::chrono::steady_clock::now() +
+                       std::chrono::seconds(2);
+          while(std::chrono::steady_clock::now() < until)
+            detail::write_all(fd, junk.data(), junk.size());
+        });
+      });
+
+      run_options options;
+      options.timeout = milliseconds(50);
+      options.worker_pool = true;
+      recording_logger log;
+      run_tests(s, log, options);
+      expect(log.events, array("start inner", "timed out streams",
+                               "end inner"));
+      expect(log.timeouts, each(less(milliseconds(1000))));
+    });
   });
 
   subsuite<>(_, "run_tests()", [](auto &_) {
@@ -92,5 +407,393 @@ suite<> test_runner("test runner", [](auto &_) {
       run_tests(s, log);
       expect(log.tests_run, equal_to(3));
     });
+
+    _.test("parallel tests are logged in order", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        _.test("test 1", []() {
+          usleep(50000);
+        });
+        _.test("test 2", []() {
+          abort();
+        });
+        _.skip_test("test 3", []() {});
+
+        subsuite<>(_, "subsuite", [](auto &_) {
+          _.test("test 4", []() {});
+        });
+      });
+
+      std::vector<std::string> expected = {
+        "start inner", "passed test 1", "failed test 2", "skipped test 3",
+        "end inner", "start subsuite", "passed test 4", "end subsuite"
+      };
+
+      recording_logger serial;
+      run_tests(s, serial);
+      expect(serial.events, equal_to(expected));
+
+      recording_logger parallel;
+      run_tests(s, parallel, true, 4);
+      expect(parallel.events, equal_to(expected));
+
+      run_options options;
+      options.worker_pool = true;
+      options.jobs = 2;
+      recording_logger pooled;
+      run_tests(s, pooled, options);
+      expect(pooled.events, equal_to(expected));
+
+      recording_logger unforked;
+      auto safe = make_suites<>("inner", [](auto &_){
+        _.test("test 1", []() {});
+      });
+      run_tests(safe, unforked, false, 4);
+      expect(unforked.events, equal_to(std::vector<std::string>{
+        "start inner", "passed test 1", "end inner"
+      }));
+    });
+
+    _.test("benchmarks are logged", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        bench_options options;
+        options.target = std::chrono::milliseconds(5);
+        options.samples = 3;
+        _.test("test 1", []() {});
+        _.bench("bench 1", []() {}, options);
+      });
+
+      std::vector<std::string> expected = {
+        "start inner", "passed test 1", "passed bench bench 1", "end inner"
+      };
+
+      for(bool fork_tests : {true, false}) {
+        recording_logger log;
+        run_tests(s, log, fork_tests);
+        expect(log.events, equal_to(expected));
+        expect(log.benches.size(), equal_to<size_t>(1));
+        expect(log.benches[0].samples, equal_to<size_t>(3));
+      }
+    });
+
+    _.test("shared fixtures are set up once", []() {
+      auto setups = std::make_shared<size_t>(0);
+      auto teardowns = std::make_shared<size_t>(0);
+      auto s = make_suites<int>("inner", [setups, teardowns](auto &_){
+        _.setup_all([setups, getpid_ = getpid()](int &x) {
+          // Make sure we're set up in the runner's process.
+          expect(getpid(), equal_to(getpid_));
+          (*setups)++;
+          x = 1;
+        });
+        _.teardown_all([teardowns](int &) {
+          (*teardowns)++;
+        });
+
+        _.test("test 1", [](int &x) {
+          x++;
+        });
+        _.test("test 2", [](int &x) {
+          expect(x, greater_equal(1));
+        });
+        _.skip_test("test 3", [](int &) {});
+      });
+
+      for(bool fork_tests : {true, false}) {
+        *setups = *teardowns = 0;
+        recording_logger log;
+        run_tests(s, log, fork_tests, 2);
+        expect(log.events, equal_to(std::vector<std::string>{
+          "start inner", "passed test 1", "passed test 2", "skipped test 3",
+          "end inner"
+        }));
+        expect(*setups, equal_to<size_t>(1));
+        expect(*teardowns, equal_to<size_t>(1));
+      }
+    });
+
+    _.test("pooled workers tear down their own shared fixtures", []() {
+      int pipefd[2];
+      expect(pipe(pipefd), equal_to(0));
+      int out = pipefd[1];
+      auto s = make_suites<>("inner", [out](auto &_){
+        _.test("test 1", []() {});
+
+        subsuite<int>(_, "subsuite", [out](auto &_) {
+          _.setup_all([out](int &) {
+            expect(write(out, "s", 1), equal_to(1));
+          });
+          _.teardown_all([out](int &) {
+            expect(write(out, "t", 1), equal_to(1));
+          });
+          _.test("test 2", [](int &) {});
+        });
+      });
+
+      run_options options;
+      options.worker_pool = true;
+      recording_logger log;
+      run_tests(s, log, options);
+      close(pipefd[1]);
+
+      std::string events;
+      char c;
+      while(read(pipefd[0], &c, 1) == 1)
+        events += c;
+      close(pipefd[0]);
+
+      // The runner sets up the subsuite's fixture before starting test 2, but
+      // the worker had already been forked for test 1, so it sets up its own
+      // copy, and should tear that down when it exits.
+      expect(log.events, equal_to(std::vector<std::string>{
+        "start inner", "passed test 1", "end inner", "start subsuite",
+        "passed test 2", "end subsuite"
+      }));
+      expect(events, equal_to("sstt"));
+    });
+
+    _.test("filtered tests aren't run", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        _.test("test 1", []() {});
+        _.test("test 2", []() {
+          abort();
+        });
+        _.skip_test("test 3", []() {});
+
+        subsuite<>(_, "subsuite", [](auto &_) {
+          _.test("test 4", []() {});
+        });
+        subsuite<>(_, "empty", [](auto &) {});
+      });
+
+      run_options options;
+      options.filter.include("inner > test [13]");
+      recording_logger included;
+      run_tests(s, included, options);
+      expect(included.events, equal_to(std::vector<std::string>{
+        "start inner", "passed test 1", "skipped test 3", "end inner"
+      }));
+
+      options.filter = test_filter();
+      options.filter.exclude("inner > test 2");
+      options.filter.exclude("inner > subsuite");
+      recording_logger excluded;
+      run_tests(s, excluded, options);
+      expect(excluded.events, equal_to(std::vector<std::string>{
+        "start inner", "passed test 1", "skipped test 3", "end inner"
+      }));
+    });
+
+    _.test("filtered tests are shown inside their parent suites", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        subsuite<>(_, "middle", [](auto &_) {
+          subsuite<>(_, "subsuite", [](auto &_) {
+            _.test("test 1", []() {});
+            _.test("test 2", []() {});
+          });
+        });
+      });
+
+      run_options options;
+      options.filter.include("inner > middle > subsuite > test 1");
+      recording_logger log;
+      run_tests(s, log, options);
+      expect(log.events, equal_to(std::vector<std::string>{
+        "start inner", "end inner", "start middle", "end middle",
+        "start subsuite", "passed test 1", "end subsuite"
+      }));
+    });
+
+    _.test("tests can be sharded", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        for(int i = 0; i != 20; i++)
+          _.test("test " + std::to_string(i), []() {});
+        _.skip_test("skipped", []() {});
+        subsuite<>(_, "empty", [](auto &) {});
+      });
+
+      auto run_shard = [&s](size_t index, auto cost) {
+        run_options options;
+        options.shard.index = index;
+        options.shard.count = 3;
+        options.shard.cost = cost;
+        recording_logger log;
+        run_tests(s, log, options);
+
+        std::vector<std::string> tests;
+        for(const auto &i : log.events) {
+          if(i.find("start ") != 0 && i.find("end ") != 0)
+            tests.push_back(i);
+        }
+        return tests;
+      };
+
+      auto check_shards = [&](auto cost) {
+        std::vector<std::string> all;
+        for(size_t i = 0; i != 3; i++) {
+          auto tests = run_shard(i, cost);
+          expect(run_shard(i, cost), equal_to(tests));
+          expect(tests.size(), less(21u));
+          all.insert(all.end(), tests.begin(), tests.end());
+        }
+
+        std::sort(all.begin(), all.end());
+        expect(all.size(), equal_to(21u));
+        expect(std::unique(all.begin(), all.end()), equal_to(all.end()));
+      };
+
+      check_shards(nullptr);
+      check_shards([](const test_name &test) {
+        return std::chrono::nanoseconds(test.test == "test 0" ? 100 : 1);
+      });
+
+      // The expensive test gets a shard to itself, and the other tests are
+      // split evenly between the rest.
+      auto cost = [](const test_name &test) {
+        return std::chrono::nanoseconds(test.test == "test 0" ? 1000 : 1);
+      };
+      std::vector<size_t> sizes;
+      for(size_t i = 0; i != 3; i++) {
+        auto tests = run_shard(i, cost);
+        tests.erase(std::remove(tests.begin(), tests.end(), "skipped skipped"),
+                    tests.end());
+        if(std::find(tests.begin(), tests.end(), "passed test 0") !=
+           tests.end())
+          expect(tests.size(), equal_to(1u));
+        else
+          sizes.push_back(tests.size());
+      }
+      expect(sizes, array(10u, 9u));
+    });
+
+    _.test("sharded tests are shown inside their parent suites", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        subsuite<>(_, "subsuite", [](auto &_) {
+          for(int i = 0; i != 20; i++)
+            _.test("test " + std::to_string(i), []() {});
+        });
+      });
+
+      for(size_t i = 0; i != 3; i++) {
+        run_options options;
+        options.shard.index = i;
+        options.shard.count = 3;
+        recording_logger log;
+        run_tests(s, log, options);
+
+        expect(log.events.size(), greater(5u));
+        expect(std::vector<std::string>(log.events.begin(),
+                                        log.events.begin() + 3),
+               equal_to(std::vector<std::string>{
+                 "start inner", "end inner", "start subsuite"
+               }));
+        expect(log.events.back(), equal_to("end subsuite"));
+      }
+    });
+
+    _.test("fail fast", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        _.test("test 1", []() {});
+        _.test("test 2", []() {
+          expect(false, equal_to(true));
+        });
+        _.skip_test("test 3", []() {});
+        _.test("test 4", []() {
+          expect(false, equal_to(true));
+        });
+        _.test("test 5", []() {});
+      });
+
+      auto events_for = [&s](size_t fail_fast, bool fork_tests,
+                             bool worker_pool = false) {
+        run_options options;
+        options.fail_fast = fail_fast;
+        options.fork_tests = fork_tests;
+        options.worker_pool = worker_pool;
+        recording_logger log;
+        run_tests(s, log, options);
+        return log.events;
+      };
+
+      std::vector<std::string> first = {
+        "start inner", "passed test 1", "failed test 2", "end inner"
+      };
+      std::vector<std::string> second = {
+        "start inner", "passed test 1", "failed test 2", "skipped test 3",
+        "failed test 4", "end inner"
+      };
+      std::vector<std::string> all = {
+        "start inner", "passed test 1", "failed test 2", "skipped test 3",
+        "failed test 4", "passed test 5", "end inner"
+      };
+
+      for(bool fork_tests : {false, true}) {
+        expect(events_for(1, fork_tests), equal_to(first));
+        expect(events_for(2, fork_tests), equal_to(second));
+        expect(events_for(3, fork_tests), equal_to(all));
+        expect(events_for(0, fork_tests), equal_to(all));
+      }
+      expect(events_for(1, true, true), equal_to(first));
+    });
+
+    _.test("tests can be reordered", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        _.test("test 1", []() {});
+        _.test("test 2", []() {
+          abort();
+        });
+        _.skip_test("test 3", []() {});
+
+        subsuite<>(_, "subsuite", [](auto &_) {
+          _.test("test 4", []() {});
+        });
+      });
+
+      std::vector<std::string> expected = {
+        "start inner", "skipped test 3", "end inner",
+        "start subsuite", "passed test 4", "end subsuite",
+        "start inner", "failed test 2", "passed test 1", "end inner"
+      };
+
+      run_options options;
+      options.order = [](const test_name &lhs, const test_name &rhs) {
+        return lhs.test > rhs.test;
+      };
+
+      recording_logger serial;
+      run_tests(s, serial, options);
+      expect(serial.events, equal_to(expected));
+
+      options.jobs = 4;
+      recording_logger parallel;
+      run_tests(s, parallel, options);
+      expect(parallel.events, equal_to(expected));
+
+      options.worker_pool = true;
+      recording_logger pooled;
+      run_tests(s, pooled, options);
+      expect(pooled.events, equal_to(expected));
+    });
+
+    _.test("reordered tests are shown inside their parent suites", []() {
+      auto s = make_suites<>("inner", [](auto &_){
+        subsuite<>(_, "first", [](auto &_) {
+          _.test("test 1", []() {});
+        });
+        subsuite<>(_, "second", [](auto &_) {
+          _.test("test 2", []() {});
+        });
+      });
+
+      run_options options;
+      options.order = [](const test_name &lhs, const test_name &rhs) {
+        return lhs.test > rhs.test;
+      };
+      recording_logger log;
+      run_tests(s, log, options);
+      expect(log.events, equal_to(std::vector<std::string>{
+        "start inner", "end inner", "start second", "passed test 2",
+        "end second", "start first", "passed test 1", "end first"
+      }));
+    });
   });
 });
@@ -1,6 +1,8 @@
 #include <mettle.hpp>
 using namespace mettle;
 
+#include <unistd.h>
+
 #include <memory>
 #include <stdexcept>
 
@@ -378,6 +380,113 @@ suite<> test_calling("test calling", [](auto &_) {
     expect(teardown.runs(), equal_to<size_t>(0));
   });
 
+  _.test("phases are timed", []() {
+    using std::chrono::milliseconds;
+
+    auto s = make_suite<>("inner", [](auto &_){
+      _.setup([]() {
+        usleep(20000);
+      });
+      _.teardown([]() {
+        usleep(10000);
+      });
+
+      subsuite<>(_, "subsuite", [](auto &_) {
+        _.setup([]() {
+          usleep(20000);
+        });
+        _.test("inner test", []() {
+          usleep(40000);
+        });
+      });
+    });
+
+    for(const auto &t : s.subsuites()[0]) {
+      auto timing = t.function().metrics.timing;
+      expect(timing.setup.wall, greater_equal(milliseconds(40)));
+      expect(timing.test.wall, greater_equal(milliseconds(40)));
+      expect(timing.teardown.wall, greater_equal(milliseconds(10)));
+    }
+  });
+
+  _.test("setup is timed when it fails", []() {
+    auto s = make_suite<>("inner", [](auto &_){
+      _.setup([]() {
+        expect(false, equal_to(true));
+      });
+      _.test("inner test", []() {});
+    });
+
+    for(const auto &t : s) {
+      auto timing = t.function().metrics.timing;
+      expect(timing.setup.wall.count(), greater(0));
+      expect(timing.test.wall.count(), equal_to(0));
+      expect(timing.teardown.wall.count(), equal_to(0));
+    }
+  });
+
+  _.test("setup_all called once", []() {
+    auto setups = std::make_shared<size_t>(0);
+    auto s = make_suite<int>("inner", [setups](auto &_){
+      _.setup_all([setups](int &x) {
+        (*setups)++;
+        x = 1;
+      });
+      _.test("test 1", [](int &x) {
+        expect(x, equal_to(1));
+        x++;
+      });
+      _.test("test 2", [](int &x) {
+        expect(x, equal_to(2));
+      });
+
+      subsuite<float>(_, "subsuite", [](auto &_) {
+        _.setup_all([](float &y) {
+          y = 3.5f;
+        });
+        _.test("test 3", [](int &x, float &y) {
+          expect(x, equal_to(2));
+          expect(y, equal_to(3.5f));
+        });
+      });
+    });
+
+    for(const auto &t : s) {
+      expect(t.suite_fixtures.size(), equal_to<size_t>(1));
+      expect(t.function().passed, equal_to(true));
+    }
+    for(const auto &t : s.subsuites()[0]) {
+      expect(t.suite_fixtures.size(), equal_to<size_t>(2));
+      expect(t.function().passed, equal_to(true));
+    }
+    expect(*setups, equal_to<size_t>(1));
+
+    // The fixtures are only torn down when asked.
+    s.begin()->suite_fixtures[0]->teardown();
+    expect(s.begin()->suite_fixtures[0]->ready(), equal_to(false));
+  });
+
+  _.test("setup_all failure fails every test", []() {
+    auto setups = std::make_shared<size_t>(0);
+    auto s = make_suite<>("inner", [setups](auto &_){
+      _.setup_all([setups]() {
+        (*setups)++;
+        throw std::runtime_error("oops");
+      });
+      _.test("test 1", []() {});
+      _.test("test 2", []() {});
+    });
+
+    for(const auto &t : s) {
+      auto result = t.function();
+      expect(result.passed, equal_to(false));
+      expect(result.message, equal_to(
+        "Uncaught exception: setup_all failed: oops"
+      ));
+    }
+    expect(*setups, equal_to<size_t>(1));
+  });
+
   _.test("test fails when teardown fails", []() {
     run_counter<> teardown([]() {
       expect(false, equal_to(true));
@@ -399,6 +508,66 @@ suite<> test_calling("test calling", [](auto &_) {
     expect(teardown.runs(), equal_to<size_t>(1));
   });
 
+  _.test("benchmarks are timed", []() {
+    using std::chrono::milliseconds;
+
+    run_counter<int> setup, teardown;
+    bench_options options;
+    options.target = milliseconds(20);
+    options.warmup = milliseconds(1);
+    options.samples = 5;
+
+    auto s = make_suite<int>("inner", [&setup, &teardown, options](auto &_){
+      _.setup(setup);
+      _.teardown(teardown);
+      _.bench("inner bench", [](int &) {
+        usleep(1000);
+      }, options);
+    });
+
+    for(const auto &t : s) {
+      expect(t.bench, equal_to(true));
+      auto result = t.function();
+      expect(result.passed, equal_to(true));
+      expect(result.bench.samples, equal_to<size_t>(5));
+      expect(result.bench.iterations, greater_equal<size_t>(1));
+      expect(result.bench.mean, greater_equal(milliseconds(1)));
+      expect(result.bench.min, less_equal(result.bench.median));
+      expect(result.bench.median, less_equal(result.bench.max));
+    }
+
+    expect(setup.runs(), equal_to<size_t>(1));
+    expect(teardown.runs(), equal_to<size_t>(1));
+  });
+
+  _.test("benchmark timing can be paused", []() {
+    using std::chrono::milliseconds;
+
+    bench_options options;
+    options.target = milliseconds(10);
+    options.warmup = milliseconds(0);
+    options.samples = 2;
+
+    auto s = make_suite<>("inner", [options](auto &_){
+      _.bench("inner bench", []() {
+        pause_timing();
+        usleep(2000);
+        resume_timing();
+      }, options);
+    });
+
+    for(const auto &t : s) {
+      auto start = std::chrono::steady_clock::now();
+      auto result = t.function();
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      expect(result.passed, equal_to(true));
+      expect(result.bench.mean, less(milliseconds(1)));
+      // Time spent paused still counts towards the target, so this shouldn't
+      // run much longer than it. Leave plenty of room for a busy machine.
+      expect(elapsed, less(milliseconds(500)));
+    }
+  });
+
 });
 
 suite<basic_fixture> test_fixtures("suite fixtures", [](auto &_) {